@@ -0,0 +1,164 @@
+# Packs a directory of web assets into a generated source file that is
+# compiled into the target. Text assets are stored gzip-compressed, and the
+# index is sorted by path so lookups don't need to walk anything at runtime.
+#
+#   webview_add_asset_pack(<target> <dir> [NAME <name>])
+#
+# Declare the pack in C++ with WEBVIEW_ASSET_PACK(<name>) (default name:
+# "assets") and serve it with WebView::serveAssets.
+function(webview_add_asset_pack target dir)
+
+  cmake_parse_arguments(PACK "" "NAME" "" ${ARGN})
+  if(NOT PACK_NAME)
+    set(PACK_NAME assets)
+  endif()
+
+  if(CMAKE_VERSION VERSION_LESS 3.18)
+    message(FATAL_ERROR "webview_add_asset_pack requires CMake 3.18 or newer")
+  endif()
+
+  get_filename_component(dir ${dir} ABSOLUTE)
+  file(GLOB_RECURSE files CONFIGURE_DEPENDS ${dir}/*)
+
+  set(output ${CMAKE_CURRENT_BINARY_DIR}/webview_assets_${PACK_NAME}.cpp)
+  add_custom_command(
+    OUTPUT ${output}
+    COMMAND ${CMAKE_COMMAND}
+      -DWEBVIEW_ASSET_PACK_NAME=${PACK_NAME}
+      -DWEBVIEW_ASSET_PACK_DIR=${dir}
+      -DWEBVIEW_ASSET_PACK_OUTPUT=${output}
+      -P ${CMAKE_CURRENT_FUNCTION_LIST_FILE}
+    DEPENDS ${files} ${CMAKE_CURRENT_FUNCTION_LIST_FILE}
+    COMMENT "Packing web assets in ${dir}"
+    VERBATIM
+  )
+  target_sources(${target} PRIVATE ${output})
+
+endfunction()
+
+function(_webview_asset_mime file out)
+
+  get_filename_component(ext ${file} LAST_EXT)
+  string(TOLOWER "${ext}" ext)
+
+  set(mime application/octet-stream)
+  set(compress FALSE)
+  if(ext STREQUAL ".html" OR ext STREQUAL ".htm")
+    set(mime text/html)
+    set(compress TRUE)
+  elseif(ext STREQUAL ".js" OR ext STREQUAL ".mjs")
+    set(mime text/javascript)
+    set(compress TRUE)
+  elseif(ext STREQUAL ".css")
+    set(mime text/css)
+    set(compress TRUE)
+  elseif(ext STREQUAL ".json" OR ext STREQUAL ".map")
+    set(mime application/json)
+    set(compress TRUE)
+  elseif(ext STREQUAL ".svg")
+    set(mime image/svg+xml)
+    set(compress TRUE)
+  elseif(ext STREQUAL ".txt")
+    set(mime text/plain)
+    set(compress TRUE)
+  elseif(ext STREQUAL ".wasm")
+    set(mime application/wasm)
+    set(compress TRUE)
+  elseif(ext STREQUAL ".png")
+    set(mime image/png)
+  elseif(ext STREQUAL ".jpg" OR ext STREQUAL ".jpeg")
+    set(mime image/jpeg)
+  elseif(ext STREQUAL ".gif")
+    set(mime image/gif)
+  elseif(ext STREQUAL ".webp")
+    set(mime image/webp)
+  elseif(ext STREQUAL ".ico")
+    set(mime image/x-icon)
+  elseif(ext STREQUAL ".woff")
+    set(mime font/woff)
+  elseif(ext STREQUAL ".woff2")
+    set(mime font/woff2)
+  elseif(ext STREQUAL ".ttf")
+    set(mime font/ttf)
+  endif()
+
+  set(${out} ${mime} PARENT_SCOPE)
+  set(${out}_COMPRESS ${compress} PARENT_SCOPE)
+
+endfunction()
+
+# Script mode: generate the pack source
+if(DEFINED WEBVIEW_ASSET_PACK_OUTPUT)
+  set(name ${WEBVIEW_ASSET_PACK_NAME})
+  set(dir ${WEBVIEW_ASSET_PACK_DIR})
+
+  file(GLOB_RECURSE files RELATIVE ${dir} ${dir}/*)
+  list(SORT files)
+
+  # Blob layout per entry: path, mime, data
+  # Index per entry: path offset, path size, mime offset, mime size,
+  # data offset, data size, gzip
+  set(blob "")
+  set(index "")
+  set(offset 0)
+  set(count 0)
+  set(tmp ${WEBVIEW_ASSET_PACK_OUTPUT}.gz)
+
+  foreach(file ${files})
+    set(path "/${file}")
+    _webview_asset_mime(${file} mime)
+
+    file(READ ${dir}/${file} data HEX)
+    set(gzip 0)
+    if(mime_COMPRESS)
+      file(ARCHIVE_CREATE OUTPUT ${tmp} PATHS ${dir}/${file}
+        FORMAT raw COMPRESSION GZip)
+      file(READ ${tmp} compressed HEX)
+      # Zero out the gzip timestamp so builds are reproducible
+      string(SUBSTRING "${compressed}" 0 8 head)
+      string(SUBSTRING "${compressed}" 16 -1 tail)
+      set(compressed "${head}00000000${tail}")
+
+      string(LENGTH "${data}" raw_len)
+      string(LENGTH "${compressed}" compressed_len)
+      if(compressed_len LESS raw_len)
+        set(data "${compressed}")
+        set(gzip 1)
+      endif()
+    endif()
+
+    string(HEX "${path}" path_hex)
+    string(HEX "${mime}" mime_hex)
+    string(LENGTH "${path_hex}" path_len)
+    string(LENGTH "${mime_hex}" mime_len)
+    string(LENGTH "${data}" data_len)
+    math(EXPR path_len "${path_len} / 2")
+    math(EXPR mime_len "${mime_len} / 2")
+    math(EXPR data_len "${data_len} / 2")
+
+    math(EXPR mime_offset "${offset} + ${path_len}")
+    math(EXPR data_offset "${mime_offset} + ${mime_len}")
+    string(APPEND index "    ${offset}, ${path_len}, ${mime_offset}, ${mime_len}, ${data_offset}, ${data_len}, ${gzip},  // ${path}\n")
+    string(APPEND blob "${path_hex}${mime_hex}${data}")
+    math(EXPR offset "${data_offset} + ${data_len}")
+    math(EXPR count "${count} + 1")
+  endforeach()
+  file(REMOVE ${tmp})
+
+  # One byte per line would be huge, so emit 16 bytes per line
+  string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," blob "${blob}")
+  string(REGEX REPLACE "(0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,)" "\\1\n    " blob "${blob}")
+
+  file(WRITE ${WEBVIEW_ASSET_PACK_OUTPUT}
+"// Generated by webview_add_asset_pack() from ${dir}. Do not edit.
+#include <cstddef>
+
+extern const std::size_t webview_assets_${name}_count = ${count};
+
+extern const std::size_t webview_assets_${name}_index[] = {
+${index}    0};
+
+extern const unsigned char webview_assets_${name}_blob[] = {
+    ${blob}0};
+")
+endif()
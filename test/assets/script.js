@@ -0,0 +1,3 @@
+window.onload = function () {
+  window.external.invoke('onload');
+};
@@ -0,0 +1,94 @@
+// Opens windows with each web context preset and reports the time to first
+// paint and the memory used, summed over this process and the WebKit
+// processes it started. Context options are per process, so each preset
+// runs in a fresh copy of this program.
+//
+//   bench-context [windows] [preset]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "process-rss.hpp"
+#include "webview.hpp"
+
+// Painted once the frame after the first one starts, so the first frame
+// has been drawn
+constexpr auto page =
+    "data:text/html,<h1>Dashboard pane</h1><p>Some text to lay out</p>"
+    "<script>requestAnimationFrame(()=>requestAnimationFrame("
+    "()=>window.external.invoke('painted')))</script>";
+
+int main(int argc, char** argv) {
+    size_t windows =
+        argc > 1 ? std::max(1ul, std::strtoul(argv[1], nullptr, 10)) : 4;
+    if (argc < 3) {
+        for (auto preset : {"default", "kiosk", "dashboard", "lowMemory"}) {
+            std::string command = std::string(argv[0]) + " " +
+                                  std::to_string(windows) + " " + preset;
+            if (std::system(command.c_str()) != 0) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    std::string preset = argv[2];
+    wv::ContextOptions options;
+    if (preset == "kiosk") {
+        options = wv::ContextOptions::kiosk();
+    } else if (preset == "dashboard") {
+        options = wv::ContextOptions::dashboard();
+    } else if (preset == "lowMemory") {
+        options = wv::ContextOptions::lowMemory();
+    }
+    wv::WebView::setContextOptions(options);
+
+    std::vector<std::unique_ptr<wv::WebView>> views;
+    std::vector<double> firstPaint;
+    bool painted = false;
+    for (size_t i = 0; i < windows; i++) {
+        auto w = std::make_unique<wv::WebView>(400, 300, true, false,
+                                               "bench-context");
+        w->navigate(page);
+        w->setCallback([&painted](wv::WebView&, std::string&) {
+            painted = true;
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        painted = false;
+        if (w->init() == -1) {
+            return 1;
+        }
+        while (!painted) {
+            w->run();
+        }
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        firstPaint.push_back(elapsed.count());
+        views.push_back(std::move(w));
+    }
+
+    // Let the web processes settle before measuring
+    auto settle = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - settle <
+           std::chrono::seconds(1)) {
+        views.front()->runFor(std::chrono::milliseconds(50));
+    }
+
+    double total = 0;
+    for (double ms : firstPaint) {
+        total += ms;
+    }
+    std::printf(
+        "%-10s %zu windows: first paint %.1f ms (first window), %.1f ms "
+        "(mean), %ld KiB\n",
+        preset.c_str(), windows, firstPaint.front(),
+        total / static_cast<double>(firstPaint.size()), treeRss());
+    return 0;
+}
@@ -0,0 +1,55 @@
+// Floods the UI thread with dispatch() calls from several threads and
+// reports how many it runs per second, and how many main loop iterations
+// it took. Coalesced wakeups keep the iterations far below the call count.
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "webview.hpp"
+
+WEBVIEW_MAIN {
+    constexpr size_t producers = 8;
+    constexpr size_t perProducer = 200000;
+    constexpr size_t total = producers * perProducer;
+
+    wv::WebView w;
+    if (w.init() == -1) {
+        return 1;
+    }
+
+    size_t received = 0;  // Only touched on the UI thread
+    size_t iterations = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < producers; i++) {
+        threads.emplace_back([&w, &received, start]() {
+            for (size_t j = 0; j < perProducer; j++) {
+                w.dispatch([&received, start](wv::WebView &view) {
+                    if (++received < total) {
+                        return;
+                    }
+
+                    std::chrono::duration<double> elapsed =
+                        std::chrono::steady_clock::now() - start;
+                    std::printf("%zu calls from %zu threads in %.3f s\n",
+                                total, producers, elapsed.count());
+                    std::printf("%.0f calls/s\n",
+                                static_cast<double>(total) / elapsed.count());
+                    view.exit();
+                });
+            }
+        });
+    }
+
+    while (w.run() == 0) {
+        iterations++;
+    }
+    std::printf("%zu main loop iterations\n", iterations);
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    return 0;
+}
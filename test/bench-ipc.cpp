@@ -0,0 +1,182 @@
+// Measures the cost of talking to the page and prints the results as JSON,
+// so runs can be compared between releases:
+//
+// - invoke: C++ evals a script that calls window.external.invoke, until the
+//   callback gets the message
+// - eval: async eval of a trivial script, until its callback runs
+// - throughput: messages/sec and MB/s sent from JS, for 16 B to 16 MB
+// - css: adding a stylesheet, until the page has applied it
+// - navigate: navigate(), until the new page's onload
+//
+// Run it under Xvfb on machines without a display.
+
+#include <algorithm>
+#include <chrono>
+#include <clocale>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "webview.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t roundTrips = 2000;
+constexpr size_t navigations = 50;
+constexpr size_t throughputBytes = 64 * 1024 * 1024;  // Sent per payload size
+
+static double micros(Clock::duration d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+
+// Runs the main loop until done is set by a callback
+static void runUntil(wv::WebView &w, const bool &done) {
+    while (!done) {
+        if (w.run()) {
+            std::exit(1);  // Window closed
+        }
+    }
+}
+
+static std::string percentiles(std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double p) {
+        auto i = static_cast<size_t>(p * static_cast<double>(samples.size()));
+        return samples[std::min(i, samples.size() - 1)];
+    };
+    char buf[256];
+    std::snprintf(buf, sizeof(buf),
+                  "{\"samples\":%zu,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,"
+                  "\"max\":%.1f}",
+                  samples.size(), at(0.5), at(0.9), at(0.99), samples.back());
+    return buf;
+}
+
+WEBVIEW_MAIN {
+    wv::WebView w;
+    bool done = false;
+    size_t received = 0;
+    Clock::time_point start;
+
+    // Counting is all the callback does, so it doesn't skew the results
+    w.setCallback([&](wv::WebView &, wv::StringView msg) {
+        if (msg == Str("end") || msg == Str("ready")) {
+            done = true;
+        } else {
+            received++;
+        }
+    });
+
+    w.preEval(Str(R"(
+        window.sendBench = function(size, count) {
+            const msg = 'x'.repeat(size);
+            for (let i = 0; i < count; i++) window.external.invoke(msg);
+            window.external.invoke('end');
+        };
+        window.onload = function() {
+            window.external.invoke('ready');
+        };
+    )"));
+
+    if (w.init() == -1) {
+        return 1;
+    }
+    // init sets the locale from the environment, which may format numbers
+    // with a decimal comma; the output is JSON
+    std::setlocale(LC_NUMERIC, "C");
+    runUntil(w, done);
+
+    // Invoke round trips
+    std::vector<double> invoke;
+    for (size_t i = 0; i < roundTrips; i++) {
+        done = false;
+        start = Clock::now();
+        w.eval(Str("window.external.invoke('end')"), nullptr);
+        runUntil(w, done);
+        invoke.push_back(micros(Clock::now() - start));
+    }
+
+    // Eval round trips
+    std::vector<double> eval;
+    for (size_t i = 0; i < roundTrips; i++) {
+        done = false;
+        start = Clock::now();
+        w.eval(Str("1"), [&](wv::WebView &, bool, wv::String &) {
+            done = true;
+        });
+        runUntil(w, done);
+        eval.push_back(micros(Clock::now() - start));
+    }
+
+    // Throughput per payload size
+    std::string throughput;
+    for (size_t size = 16; size <= 16 * 1024 * 1024; size *= 16) {
+        size_t count = std::clamp<size_t>(throughputBytes / size, 4, 100000);
+        wv::String js = Str("window.sendBench(");
+        wv::json::write(js, size);
+        js += ',';
+        wv::json::write(js, count);
+        js += ')';
+
+        done = false;
+        received = 0;
+        start = Clock::now();
+        w.eval(js, nullptr);
+        runUntil(w, done);
+        double seconds = micros(Clock::now() - start) / 1e6;
+
+        char buf[256];
+        std::snprintf(buf, sizeof(buf),
+                      "%s{\"bytes\":%zu,\"messages\":%zu,\"msgs_per_s\":%.0f,"
+                      "\"mb_per_s\":%.1f}",
+                      throughput.empty() ? "" : ",", size, received,
+                      static_cast<double>(received) / seconds,
+                      static_cast<double>(received * size) / seconds / 1e6);
+        throughput += buf;
+    }
+
+    // Stylesheets of growing size, timed until a style that depends on
+    // them is computed
+    std::string css;
+    for (size_t rules : {size_t{10}, size_t{1000}, size_t{100000}}) {
+        wv::String sheet;
+        for (size_t i = 0; i < rules; i++) {
+            sheet += Str(".rule");
+            wv::json::write(sheet, i);
+            sheet += Str(" { color: red; }\n");
+        }
+        sheet += Str("body { margin-top: 3px; }");
+
+        done = false;
+        start = Clock::now();
+        wv::StyleSheet handle = w.addStyleSheet(sheet);
+        w.eval(Str("getComputedStyle(document.body).marginTop"),
+               [&](wv::WebView &, bool, wv::String &) { done = true; });
+        runUntil(w, done);
+        double ms = micros(Clock::now() - start) / 1e3;
+        w.removeStyleSheet(handle);
+
+        char buf[128];
+        std::snprintf(buf, sizeof(buf), "%s{\"rules\":%zu,\"ms\":%.2f}",
+                      css.empty() ? "" : ",", rules, ms);
+        css += buf;
+    }
+
+    // Navigations, until onload of the new page
+    std::vector<double> navigate;
+    for (size_t i = 0; i < navigations; i++) {
+        done = false;
+        start = Clock::now();
+        w.navigate(Str("data:text/html,<p>Page</p>"));
+        runUntil(w, done);
+        navigate.push_back(micros(Clock::now() - start) / 1e3);
+    }
+
+    std::printf(
+        "{\"invoke_roundtrip_us\":%s,\"eval_roundtrip_us\":%s,"
+        "\"throughput\":[%s],\"css_inject\":[%s],\"navigate_ms\":%s}\n",
+        percentiles(invoke).c_str(), percentiles(eval).c_str(),
+        throughput.c_str(), css.c_str(), percentiles(navigate).c_str());
+    return 0;
+}
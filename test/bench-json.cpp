@@ -0,0 +1,126 @@
+// Compares wv::json against a naive character-at-a-time parser on a
+// telemetry-like payload: [[id, "message", [values...]], ...]
+
+#include <chrono>
+#include <cstdio>
+
+#include "webview.hpp"
+
+// Baseline: the usual hand-rolled parser, one character and one push_back
+// at a time
+struct NaiveParser {
+    wv::StringView s;
+    size_t pos = 0;
+
+    void space() {
+        while (pos < s.size() && (s[pos] == ' ' || s[pos] == ',')) pos++;
+    }
+
+    bool string(wv::String &out) {
+        out.clear();
+        pos++;  // "
+        while (pos < s.size() && s[pos] != '"') {
+            if (s[pos] == '\\') {
+                pos++;
+                out.push_back(s[pos] == 'n' ? '\n' : s[pos]);
+            } else {
+                out.push_back(s[pos]);
+            }
+            pos++;
+        }
+        pos++;  // "
+        return true;
+    }
+
+    double number() {
+        size_t start = pos;
+        while (pos < s.size() && s[pos] != ',' && s[pos] != ']') pos++;
+        return std::stod(wv::String(s.substr(start, pos - start)));
+    }
+
+    // Returns a checksum so the work can't be optimized out
+    size_t parse() {
+        size_t sum = 0;
+        wv::String str;
+        pos = 1;  // [
+        while (true) {
+            space();
+            if (s[pos] == ']') break;
+            pos++;  // [
+            sum += static_cast<size_t>(number());
+            space();
+            string(str);
+            sum += str.size();
+            space();
+            pos++;  // [
+            while (true) {
+                space();
+                if (s[pos] == ']') break;
+                sum += static_cast<size_t>(number());
+            }
+            pos += 2;  // ]]
+        }
+        return sum;
+    }
+};
+
+size_t parseFast(wv::StringView s) {
+    // Entries are decoded one at a time into the same tuple, so its string
+    // and vector buffers are reused instead of allocated per entry
+    std::tuple<long long, wv::String, std::vector<double>> entry;
+    auto &[id, message, values] = entry;
+    size_t sum = 0;
+
+    wv::json::Reader reader(s);
+    bool ok = reader.readArray([&] {
+        if (!reader.read(entry)) return false;
+        sum += static_cast<size_t>(id) + message.size();
+        for (auto v : values) sum += static_cast<size_t>(v);
+        return true;
+    });
+    return ok ? sum : 0;
+}
+
+template <typename F>
+void bench(const char *name, const wv::String &payload, F parse) {
+    constexpr int runs = 20;
+    size_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) {
+        sum += parse(payload);
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    double mb = static_cast<double>(payload.size() * runs) / (1024 * 1024);
+    std::printf("%-8s %8.1f MB/s (checksum %zu)\n", name,
+                mb / elapsed.count(), sum / runs);
+}
+
+WEBVIEW_MAIN {
+    // ~16 MB of messages with long strings and a few escapes
+    wv::String payload = Str("[");
+    wv::String message(200, 'x');
+    message += Str("\"quoted\"\n");
+    for (int i = 0; i < 70000; i++) {
+        if (i > 0) payload += ',';
+        payload += Str("[");
+        wv::json::write(payload, i);
+        payload += ',';
+        wv::json::write(payload, message);
+        payload += Str(",[1.5,2,3.25,4,5]]");
+    }
+    payload += Str("]");
+
+    std::printf("payload  %8.1f MB\n",
+                static_cast<double>(payload.size()) / (1024 * 1024));
+    bench("naive", payload,
+          [](const wv::String &s) { return NaiveParser{s}.parse(); });
+    bench("wv::json", payload,
+          [](const wv::String &s) { return parseFast(s); });
+    bench("validate", payload, [](const wv::String &s) {
+        return static_cast<size_t>(wv::json::validate(s));
+    });
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+// Measures messages/sec and C++ heap allocations per message for
+// window.external.invoke with a String& callback, a StringView callback,
+// and a StringView callback that keeps every message in an Arena.
+// Allocations made inside the web engine aren't counted.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <new>
+
+#include "webview.hpp"
+
+static std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size) {
+    allocations++;
+    if (void *p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+constexpr size_t messages = 200000;
+
+struct Run {
+    const char *name;
+    size_t count = 0;
+    size_t startAllocations = 0;
+    std::chrono::steady_clock::time_point start;
+};
+
+WEBVIEW_MAIN {
+    wv::WebView w;
+    wv::Arena arena;
+    std::vector<wv::StringView> kept;
+    kept.reserve(messages);
+
+    Run runs[] = {{"String&", 0, 0, {}},
+                  {"StringView", 0, 0, {}},
+                  {"StringView + Arena", 0, 0, {}}};
+    size_t current = 0;
+    std::function<void(wv::WebView &)> startRun;
+
+    // Called on "end": report, then start the next run outside the callback
+    auto finish = [&](wv::WebView &webview) {
+        Run &run = runs[current];
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - run.start;
+        size_t allocs = allocations - run.startAllocations;
+        std::printf("%-20s %10.0f msgs/s %8.3f allocs/msg\n", run.name,
+                    static_cast<double>(run.count) / elapsed.count(),
+                    static_cast<double>(allocs) /
+                        static_cast<double>(run.count));
+
+        if (++current == std::size(runs)) {
+            webview.exit();
+        } else {
+            webview.dispatch(startRun);
+        }
+    };
+
+    startRun = [&](wv::WebView &webview) {
+        if (current == 0) {
+            webview.setCallback([&](wv::WebView &view, wv::String &msg) {
+                if (msg == Str("end")) {
+                    finish(view);
+                } else {
+                    runs[current].count++;
+                }
+            });
+        } else {
+            bool keep = current == 2;
+            arena.reset();
+            kept.clear();
+            webview.setCallback([&, keep](wv::WebView &view,
+                                          wv::StringView msg) {
+                if (msg == Str("end")) {
+                    finish(view);
+                    return;
+                }
+                runs[current].count++;
+                if (keep) {
+                    kept.push_back(arena.copy(msg));
+                }
+            });
+        }
+
+        runs[current].start = std::chrono::steady_clock::now();
+        runs[current].startAllocations = allocations;
+        wv::String js = Str("window.runBench(");
+        wv::json::write(js, messages);
+        js += ')';
+        webview.eval(js, nullptr);
+    };
+
+    w.setCallback([&](wv::WebView &webview, wv::String &msg) {
+        if (msg == Str("ready")) {
+            webview.dispatch(startRun);
+        }
+    });
+
+    w.preEval(Str(R"(
+        window.runBench = function(n) {
+            const msg = 'x'.repeat(64);
+            for (let i = 0; i < n; i++) window.external.invoke(msg);
+            window.external.invoke('end');
+        };
+        window.onload = function() {
+            window.external.invoke('ready');
+        };
+    )"));
+
+    if (w.init() == -1) {
+        return 1;
+    }
+
+    while (w.run() == 0)
+        ;
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+// Renders a batch of generated reports with BatchRenderer and reports the
+// documents per second and the peak memory of this process and the WebKit
+// processes it spawned.
+//
+//   bench-render [documents] [views] [--pdf]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+#include "process-rss.hpp"
+#include "webview.hpp"
+
+int main(int argc, char** argv) {
+    size_t documents = 200;
+    size_t views = 4;
+    bool pdf = false;
+    int numbers = 0;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--pdf") == 0) {
+            pdf = true;
+        } else if (numbers++ == 0) {
+            documents = std::strtoul(argv[i], nullptr, 10);
+        } else {
+            views = std::strtoul(argv[i], nullptr, 10);
+        }
+    }
+
+    std::filesystem::path dir =
+        std::filesystem::temp_directory_path() / "bench-render";
+    std::filesystem::create_directories(dir);
+
+    wv::RenderOptions options;
+    options.views = views;
+    wv::BatchRenderer renderer(options);
+    for (size_t i = 0; i < documents; i++) {
+        wv::RenderJob job;
+        job.html = "<style>td{border:1px solid #888;padding:4px}</style>"
+                   "<h1>Report " +
+                   std::to_string(i) + "</h1><table>";
+        for (int row = 0; row < 40; row++) {
+            job.html += "<tr><td>Item " + std::to_string(row) +
+                        "</td><td>" + std::to_string(row * 37 % 101) +
+                        "</td></tr>";
+        }
+        job.html += "</table>";
+        job.output =
+            (dir / ("report-" + std::to_string(i) + (pdf ? ".pdf" : ".png")))
+                .string();
+        job.format = pdf ? wv::RenderFormat::Pdf : wv::RenderFormat::Png;
+        renderer.add(std::move(job));
+    }
+
+    // Sampled after each document, which is when every view is loaded
+    long peak = treeRss();
+    wv::RenderStats stats = renderer.run([&](const wv::RenderJob&, bool) {
+        peak = std::max(peak, treeRss());
+    });
+
+    std::printf("%zu documents to %s over %zu views\n", documents,
+                pdf ? "PDF" : "PNG", views);
+    std::printf("rendered: %zu, failed: %zu\n", stats.rendered, stats.failed);
+    std::printf("%.1f docs/s, %.1f s total\n", stats.docsPerSecond(),
+                stats.seconds);
+    std::printf("peak RSS: %ld KiB\n", peak);
+
+    std::filesystem::remove_all(dir);
+    return stats.failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,79 @@
+// Takes snapshots of a headless window back to back and reports how many
+// it gets per second: WebKit's own pixels, and pixels scaled down into a
+// buffer of ours. For numbers from a machine without a GPU, run it under
+// Xvfb with WEBKIT_DISABLE_COMPOSITING_MODE=1.
+//
+//   bench-snapshot [snapshots]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "webview.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200;
+
+    wv::WebView w(1280, 800, true, false, "bench-snapshot");
+    w.setHeadless(true);
+    w.navigate(
+        "data:text/html,<style>p{font:16px sans-serif;margin:4px}</style>"
+        "<script>for(let i=0;i<60;i++)document.write('<p>Line '+i+' of a "
+        "page with enough text to fill the window</p>');"
+        "window.onload=()=>window.external.invoke('loaded')</script>");
+
+    bool loaded = false;
+    w.setCallback([&](wv::WebView&, std::string&) { loaded = true; });
+    if (w.init() == -1) {
+        return 1;
+    }
+    while (!loaded) {
+        w.run();
+    }
+
+    std::vector<uint8_t> thumbnail(320 * 4 * 200);
+    struct Run {
+        const char* name;
+        wv::Bitmap target;
+    } runs[] = {
+        {"full size", {}},
+        {"320x200", {thumbnail.data(), 320, 200, 320 * 4}},
+    };
+
+    for (const Run& run : runs) {
+        size_t done = 0;
+        size_t failed = 0;
+        long pixels = 0;
+        auto start = Clock::now();
+
+        // One snapshot at a time, the next one from the callback
+        std::function<void(wv::WebView&, bool, const wv::Bitmap&)> next =
+            [&](wv::WebView& view, bool ok, const wv::Bitmap& b) {
+                if (ok) {
+                    pixels += static_cast<long>(b.width) * b.height;
+                } else {
+                    failed++;
+                }
+                if (++done < count) {
+                    view.snapshot(wv::SnapshotRegion::Visible, next,
+                                  run.target);
+                }
+            };
+        w.snapshot(wv::SnapshotRegion::Visible, next, run.target);
+        while (done < count) {
+            w.run();
+        }
+
+        double seconds =
+            std::chrono::duration<double>(Clock::now() - start).count();
+        std::printf("%-10s %8.1f snapshots/s %8.2f ms each %8.1f Mpx/s",
+                    run.name, static_cast<double>(count) / seconds,
+                    seconds * 1e3 / static_cast<double>(count),
+                    static_cast<double>(pixels) / seconds / 1e6);
+        std::printf(failed > 0 ? " (%zu failed)\n" : "\n", failed);
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+// Loads a page with a persistent disk cache, first cold with the cache
+// cleared and then warm, and reports the time from init to the load event.
+// Each run is a fresh copy of this program, like a relaunched app. The page
+// has to be served over the network for the cache to matter.
+//
+//   bench-warm-start <url> [runs]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+#include "webview.hpp"
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s <url> [runs]\n", argv[0]);
+        return 1;
+    }
+    std::string url = argv[1];
+    std::filesystem::path dir =
+        std::filesystem::temp_directory_path() / "bench-warm-start";
+
+    // Parent: one cold run, then warm runs
+    if (argc < 4) {
+        int runs = argc > 2 ? std::atoi(argv[2]) : 5;
+        std::filesystem::remove_all(dir);
+        for (int i = 0; i <= runs; i++) {
+            std::string command = std::string(argv[0]) + " '" + url + "' 0 " +
+                                  (i == 0 ? "cold" : "warm");
+            if (std::system(command.c_str()) != 0) {
+                return 1;
+            }
+        }
+        std::filesystem::remove_all(dir);
+        return 0;
+    }
+
+    wv::ContextOptions options;
+    options.dataDirectory = (dir / "data").string();
+    options.cacheDirectory = (dir / "cache").string();
+    wv::WebView::setContextOptions(options);
+
+    wv::WebView w(800, 600, true, false, "bench-warm-start", url);
+    w.preEval(R"(
+        window.addEventListener("load", function() {
+            window.external.invoke("loaded");
+        });
+    )");
+    std::chrono::steady_clock::time_point loaded;
+    w.setCallback([&loaded](wv::WebView&, std::string&) {
+        loaded = std::chrono::steady_clock::now();
+    });
+    if (w.init() == -1) {
+        return 1;
+    }
+    while (loaded == std::chrono::steady_clock::time_point{}) {
+        w.run();
+    }
+
+    // The network process writes cache entries shortly after the load
+    auto settle = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - settle <
+           std::chrono::milliseconds(500)) {
+        w.runFor(std::chrono::milliseconds(50));
+    }
+
+    std::chrono::duration<double, std::milli> load =
+        loaded - w.startupMetrics().initStart;
+    std::printf("%s: loaded after %.1f ms, disk cache %llu KiB\n", argv[3],
+                load.count(),
+                static_cast<unsigned long long>(wv::WebView::cacheSize() /
+                                                1024));
+    return 0;
+}
@@ -0,0 +1,66 @@
+// Opens windows one at a time and reports the memory each one adds, summed
+// over this process and the WebKit processes it spawned. Pass --shared to
+// render every window in the first window's web process.
+//
+//   bench-windows [windows] [--shared]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "process-rss.hpp"
+#include "webview.hpp"
+
+int main(int argc, char** argv) {
+    size_t windows = 6;
+    bool shared = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--shared") == 0) {
+            shared = true;
+        } else {
+            windows = std::strtoul(argv[i], nullptr, 10);
+        }
+    }
+
+    std::vector<std::unique_ptr<wv::WebView>> views;
+    size_t loaded = 0;
+    long before = treeRss();
+    std::printf("%s web processes\n", shared ? "Shared" : "Separate");
+    std::printf("baseline: %ld KiB\n", before);
+
+    for (size_t i = 0; i < windows; i++) {
+        auto w = std::make_unique<wv::WebView>(400, 300, true, false,
+                                               "bench-windows");
+        w->navigate(
+            "data:text/html,<h1>Pane</h1><script>"
+            "window.onload=()=>window.external.invoke('loaded')</script>");
+        w->setCallback([&loaded](wv::WebView&, std::string&) { loaded++; });
+        if (shared && !views.empty()) {
+            w->shareWebProcess(*views.front());
+        }
+        if (w->init() == -1) {
+            return 1;
+        }
+        views.push_back(std::move(w));
+
+        // One loop drives every window
+        while (loaded < views.size()) {
+            views.front()->run();
+        }
+        // Let the new web process settle before measuring
+        auto settle = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - settle <
+               std::chrono::milliseconds(500)) {
+            views.front()->runFor(std::chrono::milliseconds(50));
+        }
+
+        long now = treeRss();
+        std::printf("%zu windows: %ld KiB (+%ld KiB)\n", views.size(), now,
+                    now - before);
+        before = now;
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+// Memory use of a process tree, for the benchmarks that start WebKit
+// processes. Linux only, since it reads /proc.
+
+#pragma once
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+
+// Resident memory of this process and all of its descendants, in KiB
+inline long treeRss() {
+    std::map<long, long> parents;
+    DIR* proc = opendir("/proc");
+    while (dirent* entry = readdir(proc)) {
+        long pid = std::atol(entry->d_name);
+        if (pid <= 0) {
+            continue;
+        }
+        std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+        std::string line;
+        std::getline(stat, line);
+        // The name can contain spaces, so parse from after its ')'
+        auto end = line.rfind(')');
+        if (end == std::string::npos) {
+            continue;
+        }
+        char state;
+        long ppid;
+        if (std::sscanf(line.c_str() + end + 1, " %c %ld", &state, &ppid) ==
+            2) {
+            parents[pid] = ppid;
+        }
+    }
+    closedir(proc);
+
+    long total = 0;
+    for (const auto& [pid, ppid] : parents) {
+        long p = pid;
+        while (p > 1 && p != getpid()) {
+            auto it = parents.find(p);
+            p = it == parents.end() ? 0 : it->second;
+        }
+        if (p != getpid()) {
+            continue;
+        }
+
+        std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.compare(0, 6, "VmRSS:") == 0) {
+                total += std::atol(line.c_str() + 6);
+            }
+        }
+    }
+    return total;
+}
@@ -0,0 +1,25 @@
+#include "webview.hpp"
+
+WEBVIEW_ASSET_PACK(test);
+
+WEBVIEW_MAIN {
+    wv::WebView w;
+
+    w.serveAssets("app", test_assets);
+    w.navigate("app://local/");
+
+    w.setCallback([](wv::WebView &webview, wv::String &arg) {
+        if (arg == Str("onload")) {
+            webview.exit();
+        }
+    });
+
+    if (w.init() == -1) {
+        return 1;
+    }
+
+    while (w.run() == 0)
+        ;
+
+    return 0;
+}
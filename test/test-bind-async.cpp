@@ -0,0 +1,46 @@
+#include <chrono>
+#include <thread>
+
+#include "webview.hpp"
+
+WEBVIEW_MAIN {
+    wv::WebView w;
+    auto uiThread = std::this_thread::get_id();
+
+    w.setWorkers(4);
+    // Later calls finish first unless they run in order
+    w.bindAsync(Str("slow"), [](int n) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50 - n * 10));
+        return n;
+    });
+    w.bindAsync(
+        Str("offThread"),
+        [uiThread]() { return std::this_thread::get_id() != uiThread; },
+        wv::Ordering::Unordered);
+    w.bind(Str("done"), [&w](bool passed) {
+        if (passed) {
+            w.exit();
+        }
+    });
+
+    w.preEval(Str(R"(
+        window.onload = async function() {
+            const order = [];
+            await Promise.all([0, 1, 2, 3].map(
+                n => window.slow(n).then(r => order.push(r))));
+            const offThread = await window.offThread();
+            const invalid = await window.slow('1').catch(e => e);
+            window.done(order.join() === '0,1,2,3' && offThread &&
+                        invalid === 'Invalid arguments');
+        };
+    )"));
+
+    if (w.init() == -1) {
+        return 1;
+    }
+
+    while (w.run() == 0)
+        ;
+
+    return 0;
+}
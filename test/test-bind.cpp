@@ -0,0 +1,44 @@
+#include <stdexcept>
+
+#include "webview.hpp"
+
+WEBVIEW_MAIN {
+    wv::WebView w;
+
+    w.bind(Str("add"), [](int a, int b) { return a + b; });
+    w.bind(Str("greet"), [](const wv::String &name, std::vector<double> v) {
+        return Str("hi ") + name + (v.size() == 2 ? Str("!") : Str("?"));
+    });
+    w.bind(Str("fail"), []() { throw std::runtime_error("nope"); });
+    w.bind(Str("removed"), []() {});
+    w.unbind(Str("removed"));
+    w.bind(Str("unbindAdd"), [&w]() { w.unbind(Str("add")); });
+    w.bind(Str("done"), [&w](bool passed) {
+        if (passed) {
+            w.exit();
+        }
+    });
+
+    w.preEval(Str(R"(
+        window.onload = async function() {
+            const sum = await window.add(1, 2);
+            const greeting = await window.greet('bob', [1.5, -2]);
+            const error = await window.fail().catch(e => e);
+            const invalid = await window.add('1', 2).catch(e => e);
+            await window.unbindAdd();
+            window.done(sum === 3 && greeting === 'hi bob!' &&
+                        error === 'nope' && invalid === 'Invalid arguments' &&
+                        window.removed === undefined &&
+                        window.add === undefined);
+        };
+    )"));
+
+    if (w.init() == -1) {
+        return 1;
+    }
+
+    while (w.run() == 0)
+        ;
+
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include "webview.hpp"
+
+WEBVIEW_MAIN {
+    wv::WebView w;
+    int passed = 0;
+
+    wv::StyleSheet sheet = w.addStyleSheet(Str("body { margin: 7px; }"));
+    auto margin = Str("getComputedStyle(document.body).marginTop");
+
+    w.setCallback([&](wv::WebView &webview, wv::String &arg) {
+        if (arg != Str("ready")) {
+            return;
+        }
+
+        // Applied before the page loaded
+        webview.eval(margin, [&](wv::WebView &, bool ok, wv::String &result) {
+            passed += ok && result == Str("\"7px\"");
+        });
+
+        webview.replaceStyleSheet(sheet, Str("body { margin: 9px; }"));
+        webview.eval(margin, [&](wv::WebView &, bool ok, wv::String &result) {
+            passed += ok && result == Str("\"9px\"");
+        });
+
+        webview.removeStyleSheet(sheet);
+        webview.eval(margin, [&](wv::WebView &view, bool ok,
+                                 wv::String &result) {
+            passed += ok && result == Str("\"8px\"") && !sheet.valid();
+            view.exit();
+        });
+    });
+
+    w.preEval(Str(R"(
+        window.onload = function() {
+            window.external.invoke("ready");
+        };
+    )"));
+
+    if (w.init() == -1) {
+        return 1;
+    }
+
+    while (w.run() == 0)
+        ;
+
+    return passed == 3 ? 0 : 1;
+}
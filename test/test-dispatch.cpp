@@ -0,0 +1,62 @@
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "webview.hpp"
+
+using namespace std::chrono;
+
+WEBVIEW_MAIN {
+    constexpr size_t producers = 4;
+    constexpr size_t perProducer = 20000;
+    constexpr size_t total = producers * perProducer;
+
+    wv::WebView w;
+    auto uiThread = std::this_thread::get_id();
+
+    // Only touched on the UI thread
+    bool early = false;
+    bool passed = true;
+    size_t received = 0;
+    std::vector<size_t> next(producers, 0);
+
+    w.dispatch([&](wv::WebView &) {
+        early = std::this_thread::get_id() == uiThread;
+    });
+
+    if (w.init() == -1) {
+        return 1;
+    }
+
+    // Each item must run once, on the UI thread, after the ones its
+    // producer dispatched before it
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < producers; i++) {
+        threads.emplace_back([&, i]() {
+            for (size_t j = 0; j < perProducer; j++) {
+                w.dispatch([&, i, j](wv::WebView &) {
+                    if (std::this_thread::get_id() != uiThread ||
+                        next[i] != j) {
+                        passed = false;
+                    }
+                    next[i] = j + 1;
+                    received++;
+                });
+            }
+        });
+    }
+
+    auto deadline = steady_clock::now() + seconds(30);
+    while (received < total && steady_clock::now() < deadline) {
+        if (w.runFor(milliseconds(100))) {
+            break;
+        }
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    // Nothing runs twice
+    w.runFor(milliseconds(50));
+    return passed && early && received == total ? 0 : 1;
+}
@@ -0,0 +1,31 @@
+#include "webview.hpp"
+
+WEBVIEW_MAIN {
+    wv::WebView w;
+    bool passed = false;
+
+    w.setCallback([&](wv::WebView &webview, wv::String &arg) {
+        if (arg == Str("ready")) {
+            webview.eval(Str("[1 + 2, 'a']"), [&](wv::WebView &view, bool ok,
+                                               wv::String &result) {
+                passed = ok && result == Str("[3,\"a\"]");
+                view.exit();
+            });
+        }
+    });
+
+    w.preEval(Str(R"(
+        window.onload = function() {
+            window.external.invoke("ready");
+        };
+    )"));
+
+    if (w.init() == -1) {
+        return 1;
+    }
+
+    while (w.run() == 0)
+        ;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,48 @@
+#include "webview.hpp"
+
+WEBVIEW_MAIN {
+    wv::WebView w;
+    int step = 0;
+    bool passed = true;
+
+    auto expect = [&](int n, bool ok, const wv::String &expected) {
+        return [&, n, ok, expected](wv::WebView &, bool itemOk,
+                                    wv::String &result) {
+            passed = passed && step++ == n && itemOk == ok &&
+                     (!ok || result == expected);
+        };
+    };
+
+    w.setEvalBatching(true);
+    w.setCallback([&](wv::WebView &webview, wv::String &arg) {
+        if (arg == Str("ready")) {
+            webview.eval(Str("window.counter = 1"), expect(0, true, Str("1")));
+            webview.eval(Str("throw new Error('boom')"),
+                         expect(1, false, Str("")));
+            webview.eval(Str("'\"' + ++window.counter"),
+                         expect(2, true, Str("\"\\\"2\"")));
+            webview.eval(Str("undefined"), [&](wv::WebView &view, bool ok,
+                                            wv::String &result) {
+                auto stats = view.evalStats();
+                passed = passed && step == 3 && ok && result == Str("null") &&
+                         stats.scripts == 4 && stats.batches == 1;
+                view.exit();
+            });
+        }
+    });
+
+    w.preEval(Str(R"(
+        window.onload = function() {
+            window.external.invoke("ready");
+        };
+    )"));
+
+    if (w.init() == -1) {
+        return 1;
+    }
+
+    while (w.run() == 0)
+        ;
+
+    return passed ? 0 : 1;
+}
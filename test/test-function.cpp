@@ -0,0 +1,45 @@
+#include "webview.hpp"
+
+WEBVIEW_MAIN {
+    wv::WebView w;
+    bool passed = false;
+
+    wv::JSFunction add = w.registerFunction(Str("(a, b) => a + b"));
+    wv::JSFunction echo =
+        w.registerFunction(Str("(s) => window.external.invoke(s)"));
+
+    w.setCallback([&](wv::WebView &webview, wv::String &arg) {
+        if (arg == Str("ready")) {
+            webview.call(echo, Str("called"));
+        } else if (arg == Str("called")) {
+            webview.callWithResult(
+                add, [&](wv::WebView &view, bool ok, wv::String &result) {
+                    passed = ok && result == Str("[1,2,3]");
+
+                    // Calling an unregistered function fails
+                    view.unregisterFunction(add);
+                    view.callWithResult(
+                        add, [&](wv::WebView &v, bool ok2, wv::String &) {
+                            passed = passed && !ok2 && !add.valid();
+                            v.exit();
+                        });
+                },
+                std::vector<int>{1, 2}, std::vector<int>{3});
+        }
+    });
+
+    w.preEval(Str(R"(
+        window.onload = function() {
+            window.external.invoke("ready");
+        };
+    )"));
+
+    if (w.init() == -1) {
+        return 1;
+    }
+
+    while (w.run() == 0)
+        ;
+
+    return passed ? 0 : 1;
+}
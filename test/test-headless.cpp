@@ -0,0 +1,36 @@
+#include "webview.hpp"
+
+WEBVIEW_MAIN {
+    wv::WebView w(640, 480);
+    w.setHeadless(true);
+
+    int loads = 0;
+    bool passed = false;
+
+    w.preEval(R"(
+        window.onload = function() {
+            window.external.invoke("loaded");
+        };
+    )");
+    w.setCallback([&](wv::WebView &webview, std::string &) {
+        // The first page navigates, the second checks it was laid out at
+        // the requested size
+        if (++loads == 1) {
+            webview.navigate("data:text/html,<p>Second</p>");
+            return;
+        }
+        webview.eval("[window.innerWidth, document.body.textContent]",
+                     [&](wv::WebView &view, bool ok, std::string &result) {
+                         passed = ok && result == "[640,\"Second\"]";
+                         view.exit();
+                     });
+    });
+
+    if (w.init() == -1) {
+        return 1;
+    }
+    while (w.run() == 0)
+        ;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+// Checks wv::json on its own, without opening a window: numbers at the
+// edges of their types, escapes, and input that must be rejected
+
+#include <clocale>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+
+#include "webview.hpp"
+
+static int failed = 0;
+
+static void check(bool ok, int line) {
+    if (!ok) {
+        std::fprintf(stderr, "test-json.cpp:%d: check failed\n", line);
+        failed++;
+    }
+}
+#define CHECK(x) check(x, __LINE__)
+
+template <typename T>
+static bool read(wv::StringView s, T &v) {
+    wv::json::Reader reader(s);
+    return reader.read(v) && reader.done();
+}
+
+template <typename T>
+static bool reads(wv::StringView s, T expected) {
+    T v{};
+    return read(s, v) && v == expected;
+}
+
+template <typename T>
+static bool rejects(wv::StringView s) {
+    T v{};
+    return !read(s, v);
+}
+
+static wv::String written(double v) {
+    wv::String out;
+    wv::json::write(out, v);
+    return out;
+}
+
+static void checkNumbers() {
+    // Integers are exact over the whole range of their type
+    CHECK(reads(Str("18446744073709551615"),
+                std::numeric_limits<uint64_t>::max()));
+    CHECK(reads(Str("10000000000000000000"), uint64_t{10000000000000000000u}));
+    CHECK(rejects<uint64_t>(Str("18446744073709551616")));
+    CHECK(rejects<uint64_t>(Str("99999999999999999999")));
+    CHECK(rejects<uint64_t>(Str("-1")));
+    CHECK(reads(Str("-0"), uint64_t{0}));
+
+    CHECK(reads(Str("9223372036854775807"),
+                std::numeric_limits<int64_t>::max()));
+    CHECK(reads(Str("-9223372036854775808"),
+                std::numeric_limits<int64_t>::min()));
+    CHECK(rejects<int64_t>(Str("9223372036854775808")));
+    CHECK(rejects<int64_t>(Str("-9223372036854775809")));
+    CHECK(reads(Str("-128"), int8_t{-128}));
+    CHECK(rejects<int8_t>(Str("-129")));
+    CHECK(rejects<int>(Str("1.5")));
+    CHECK(rejects<int>(Str("1e3")));
+
+    // No leading zeros, and digits on both sides of the point
+    CHECK(rejects<int>(Str("01")));
+    CHECK(rejects<int>(Str("-01")));
+    CHECK(rejects<double>(Str("00.1")));
+    CHECK(rejects<double>(Str("1.")));
+    CHECK(rejects<double>(Str(".5")));
+    CHECK(rejects<double>(Str("1e")));
+    CHECK(reads(Str("0"), 0));
+    CHECK(reads(Str("0.5e3"), 500.0));
+
+    // Short numbers take the fast path, long ones strtod
+    CHECK(reads(Str("0.1"), 0.1));
+    CHECK(reads(Str("-2.5e-3"), -2.5e-3));
+    CHECK(reads(Str("0.1234567890123456789012345"), 0.1234567890123456789));
+    CHECK(reads(Str("123456789012345678901234567890"), 1.2345678901234568e29));
+
+    CHECK(written(1.5) == Str("1.5"));
+    CHECK(written(0.1) == Str("0.1"));
+    CHECK(written(1e300) == Str("1e+300"));
+    CHECK(written(std::numeric_limits<double>::infinity()) == Str("null"));
+}
+
+static void checkStrings() {
+    wv::String s;
+    CHECK(read(Str(R"("a\n\"\\\/\b\f\r\t\u0041")"), s) &&
+          s == Str("a\n\"\\/\b\f\r\tA"));
+
+    // Surrogate pairs are one code point
+    wv::String smile;
+    wv::json::appendCodepoint(smile, 0x1F600);
+    CHECK(read(Str(R"("\ud83d\ude00")"), s) && s == smile);
+    CHECK(read(Str(R"("\uD83D\uDE00")"), s) && s == smile);
+
+    // Only JSON's own escapes, and no lone surrogates
+    CHECK(!wv::json::validate(Str(R"("\q")")));
+    CHECK(!wv::json::validate(Str(R"("\x41")")));
+    CHECK(!wv::json::validate(Str(R"("\u00")")));
+    CHECK(!wv::json::validate(Str(R"("\ud800")")));
+    CHECK(!wv::json::validate(Str(R"("\ud800A")")));
+    CHECK(!wv::json::validate(Str(R"("\udc00")")));
+    CHECK(!wv::json::validate(Str(R"("\ude00\ud83d")")));
+}
+
+static void checkInvalid() {
+    for (wv::StringView s :
+         {Str(""), Str(" "), Str("tru"), Str("nul"), Str("-"), Str("+1"),
+          Str("1 2"), Str("\"abc"), Str("[1,"), Str("[1,]"), Str("[,1]"),
+          Str("{\"a\"}"), Str("{\"a\":1,}"), Str("{a:1}"), Str("]")}) {
+        CHECK(!wv::json::validate(s));
+    }
+    for (wv::StringView s :
+         {Str("0"), Str(" true "), Str("null"), Str("[]"), Str("{}"),
+          Str("[1,\"two\",[3.5e-1],{\"four\":null}]"), Str("\"\"")}) {
+        CHECK(wv::json::validate(s));
+    }
+}
+
+WEBVIEW_MAIN {
+    checkNumbers();
+    checkStrings();
+    checkInvalid();
+
+    // gtk_init sets the locale from the environment; numbers must stay
+    // JSON in locales with a decimal comma, where those are installed
+    for (auto locale : {"de_DE.UTF-8", "fr_FR.UTF-8", "de_DE", "German"}) {
+        if (std::setlocale(LC_NUMERIC, locale) != nullptr) {
+            checkNumbers();
+            break;
+        }
+    }
+    std::setlocale(LC_NUMERIC, "C");
+
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,46 @@
+#include "webview.hpp"
+
+WEBVIEW_MAIN {
+    wv::WebView first;
+    wv::WebView second;
+    int ready = 0;
+    bool passed = false;
+
+    auto onload = Str(R"(
+        window.onload = function() {
+            window.external.invoke("ready");
+        };
+    )");
+    first.preEval(onload);
+    second.preEval(onload);
+
+    auto callback = [&](wv::WebView &, wv::String &arg) {
+        if (arg != Str("ready") || ++ready < 2) {
+            return;
+        }
+
+        // Only the first window's run() is called, and the second one's
+        // batched evals still go out
+        second.setEvalBatching(true);
+        second.eval(Str("1 + 1"), [&](wv::WebView &, bool ok,
+                                      wv::String &result) {
+            passed = ok && result == Str("2");
+            first.exit();
+        });
+    };
+    first.setCallback(callback);
+    second.setCallback(callback);
+
+    if (first.init() == -1) {
+        return 1;
+    }
+    second.shareWebProcess(first);
+    if (second.init() == -1) {
+        return 1;
+    }
+
+    while (first.run() == 0)
+        ;
+
+    return passed ? 0 : 1;
+}
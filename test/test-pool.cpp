@@ -0,0 +1,44 @@
+#include "webview.hpp"
+
+WEBVIEW_MAIN {
+    int loaded = 0;
+
+    wv::WebViewPool pool(2, [&]() {
+        auto w = std::make_unique<wv::WebView>();
+        w->navigate("data:text/html,<p>Shell</p>");
+        w->preEval(R"(
+            window.onload = function() {
+                window.external.invoke("loaded");
+            };
+        )");
+        w->setCallback([&](wv::WebView &, std::string &arg) {
+            if (arg == "loaded") {
+                loaded++;
+            }
+        });
+        return w;
+    });
+
+    // The pool fills up while the loop is idle, and the shell pages load
+    // while the windows are hidden
+    while (pool.ready() < 2 || loaded < 2) {
+        g_main_context_iteration(nullptr, TRUE);
+    }
+
+    auto w = pool.acquire();
+    bool passed = false;
+    w->eval("document.body.textContent", [&](wv::WebView &view, bool ok,
+                                              std::string &result) {
+        passed = ok && result == "\"Shell\"";
+        view.exit();
+    });
+    while (w->run() == 0)
+        ;
+
+    // Refilled in the background
+    while (pool.ready() < 2) {
+        g_main_context_iteration(nullptr, TRUE);
+    }
+
+    return passed ? 0 : 1;
+}
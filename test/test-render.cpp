@@ -0,0 +1,49 @@
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "webview.hpp"
+
+// First bytes of the file at path
+static std::string head(const std::string &path, size_t n) {
+    std::ifstream in(path, std::ios::binary);
+    std::string bytes(n, '\0');
+    in.read(bytes.data(), static_cast<std::streamsize>(n));
+    return in ? bytes : std::string();
+}
+
+WEBVIEW_MAIN {
+    std::string dir = std::filesystem::temp_directory_path().string();
+
+    wv::RenderOptions options;
+    options.views = 2;
+    options.waitForSignal = true;
+    wv::BatchRenderer renderer(options);
+
+    for (int i = 0; i < 3; i++) {
+        // Ready a bit after load, so waiting for the signal matters
+        wv::RenderJob job;
+        job.html = "<h1>Report #" + std::to_string(i) +
+                   "</h1><script>setTimeout(()=>renderReady(), 50)</script>";
+        job.output = dir + "/webview-render-" + std::to_string(i) +
+                     (i == 2 ? ".pdf" : ".png");
+        job.format = i == 2 ? wv::RenderFormat::Pdf : wv::RenderFormat::Png;
+        renderer.add(job);
+    }
+
+    size_t calls = 0;
+    wv::RenderStats stats =
+        renderer.run([&](const wv::RenderJob &, bool) { calls++; });
+
+    bool passed = stats.rendered == 3 && stats.failed == 0 && calls == 3 &&
+                  head(dir + "/webview-render-0.png", 4) == "\x89PNG" &&
+                  head(dir + "/webview-render-1.png", 4) == "\x89PNG" &&
+                  head(dir + "/webview-render-2.pdf", 4) == "%PDF";
+    for (int i = 0; i < 3; i++) {
+        std::remove((dir + "/webview-render-" + std::to_string(i) +
+                     (i == 2 ? ".pdf" : ".png"))
+                        .c_str());
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+#include <memory>
+#include <string>
+
+#include "webview.hpp"
+
+constexpr char chunk[] = "window.external.invoke(document.title)";
+
+static wv::SchemeResponse page(const std::string &title,
+                               const std::string &script) {
+    return wv::SchemeResponse::fromString("<title>" + title +
+                                          "</title><script src='" + script +
+                                          "'></script>");
+}
+
+WEBVIEW_MAIN {
+    // Least recently used bodies go first
+    wv::ResponseCache small(10);
+    small.store("app://x/1", wv::SchemeResponse::fromString("111111"));
+    small.store("app://x/2", wv::SchemeResponse::fromString("222222"));
+    wv::ResponseCache::Stats s = small.stats();
+    if (s.evictions != 1 || s.bodies != 1 || small.lookup("app://x/1") ||
+        !small.lookup("app://x/2")) {
+        return 1;
+    }
+
+    // Both views load the same chunk, once from the same URL and once from
+    // another one returning the same bytes
+    auto cache = std::make_shared<wv::ResponseCache>();
+    int fetches = 0;
+    auto fetch = [&](const wv::SchemeRequest &req) {
+        fetches++;
+        if (req.path == "/a.html") {
+            return page("a", "chunk.js");
+        } else if (req.path == "/b.html") {
+            return page("b", "chunk.js");
+        } else if (req.path == "/c.html") {
+            return page("c", "copy.js");
+        }
+        wv::SchemeResponse res;
+        res.data = chunk;
+        res.size = sizeof(chunk) - 1;
+        res.mime = "text/javascript";
+        return res;
+    };
+
+    std::string loaded;
+    auto callback = [&](wv::WebView &, std::string &title) {
+        loaded += title;
+    };
+
+    wv::WebView first;
+    first.serveCached("app", cache, fetch);
+    first.setCallback(callback);
+    first.navigate("app://local/a.html");
+    if (first.init() == -1) {
+        return 1;
+    }
+    while (loaded != "a") {
+        first.run();
+    }
+
+    wv::WebView second;
+    second.serveCached("app", cache, fetch);
+    second.setCallback(callback);
+    second.navigate("app://local/b.html");
+    if (second.init() == -1) {
+        return 1;
+    }
+    while (loaded != "ab") {
+        second.run();
+    }
+    second.navigate("app://local/c.html");
+    while (loaded != "abc") {
+        second.run();
+    }
+
+    // chunk.js was fetched once; copy.js was fetched, but shares its body
+    s = cache->stats();
+    bool passed = fetches == 5 && s.hits == 1 && s.misses == 5 &&
+                  s.urls == 5 && s.bodies == 4;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+#include <chrono>
+
+#if defined(WEBVIEW_GTK)
+#include <poll.h>
+#endif
+
+#include "webview.hpp"
+
+using namespace std::chrono;
+
+WEBVIEW_MAIN {
+    wv::WebView w;
+    bool ready = false;
+
+    w.setCallback([&](wv::WebView &, wv::String &arg) {
+        if (arg == Str("ready")) {
+            ready = true;
+        }
+    });
+
+    w.preEval(Str(R"(
+        window.onload = function() {
+            window.external.invoke("ready");
+        };
+    )"));
+
+    if (w.init() == -1) {
+        return 1;
+    }
+
+    auto deadline = steady_clock::now() + seconds(30);
+#if defined(WEBVIEW_GTK)
+    // Drive the loop like an external reactor would
+    std::vector<GPollFD> fds;
+    std::vector<pollfd> pfds;
+    while (!ready && steady_clock::now() < deadline) {
+        int timeout = w.pollFds(fds);
+        pfds.clear();
+        for (auto &fd : fds) {
+            pfds.push_back({fd.fd, static_cast<short>(fd.events), 0});
+        }
+        ::poll(pfds.data(), pfds.size(), timeout < 0 ? 100 : timeout);
+        for (size_t i = 0; i < fds.size(); i++) {
+            fds[i].revents = static_cast<gushort>(pfds[i].revents);
+        }
+        if (w.dispatchFds(fds)) {
+            return 1;
+        }
+    }
+#else
+    while (!ready && steady_clock::now() < deadline) {
+        if (w.runFor(milliseconds(100))) {
+            return 1;
+        }
+    }
+#endif
+    if (!ready) {
+        return 1;
+    }
+
+    // Both return without waiting for events that never come
+    auto start = steady_clock::now();
+    w.runFor(milliseconds(50));
+    w.poll();
+    bool passed = steady_clock::now() - start < seconds(5);
+
+    w.exit();
+    return passed && w.poll() ? 0 : 1;
+}
@@ -0,0 +1,48 @@
+#include "webview.hpp"
+
+constexpr char page[] = R"(<!DOCTYPE html>
+<html lang="en">
+<body>
+  <script type="text/javascript">
+    fetch('data.txt', { headers: { Range: 'bytes=2-4' } })
+      .then(res => res.text())
+      .then(text => window.external.invoke(text));
+  </script>
+</body>
+</html>)";
+
+WEBVIEW_MAIN {
+    wv::WebView w;
+    bool passed = false;
+
+    w.registerScheme("app", [](const wv::SchemeRequest &req) {
+        if (req.path == "/index.html") {
+            wv::SchemeResponse res;
+            res.data = page;
+            res.size = sizeof(page) - 1;
+            return res;
+        } else if (req.path == "/data.txt") {
+            return wv::SchemeResponse::fromString("abcdefg", "text/plain");
+        }
+
+        wv::SchemeResponse res;
+        res.status = 404;
+        return res;
+    });
+
+    w.navigate("app://local/index.html");
+
+    w.setCallback([&](wv::WebView &webview, wv::String &arg) {
+        passed = arg == "cde";
+        webview.exit();
+    });
+
+    if (w.init() == -1) {
+        return 1;
+    }
+
+    while (w.run() == 0)
+        ;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,48 @@
+#include <vector>
+
+#include "webview.hpp"
+
+WEBVIEW_MAIN {
+    wv::WebView w(320, 240);
+    w.setHeadless(true);
+    w.navigate(
+        "data:text/html,<body style='margin:0;background:%230000ff'>"
+        "<script>window.onload=()=>window.external.invoke('loaded')</script>");
+
+    bool passed = false;
+    std::vector<uint8_t> pixels(80 * 4 * 60);
+
+    w.setCallback([&](wv::WebView &webview, std::string &) {
+        // WebKit's own pixels, at the size of the window
+        webview.snapshot(wv::SnapshotRegion::Visible, [&](wv::WebView &view,
+                                                          bool ok,
+                                                          const wv::Bitmap &b) {
+            if (!ok || b.width != 320 || b.height != 240) {
+                view.exit();
+                return;
+            }
+
+            // Scaled down into our buffer, and still blue
+            wv::Bitmap target{pixels.data(), 80, 60, 80 * 4};
+            view.snapshot(
+                wv::SnapshotRegion::Visible,
+                [&](wv::WebView &v, bool ok2, const wv::Bitmap &small) {
+                    const uint8_t *px = small.data + 30 * small.stride + 40 * 4;
+                    passed = ok2 && small.data == pixels.data() &&
+                             small.width == 80 && small.height == 60 &&
+                             px[0] == 255 && px[1] == 0 && px[2] == 0 &&
+                             px[3] == 255;
+                    v.exit();
+                },
+                target);
+        });
+    });
+
+    if (w.init() == -1) {
+        return 1;
+    }
+    while (w.run() == 0)
+        ;
+
+    return passed ? 0 : 1;
+}
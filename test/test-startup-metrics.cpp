@@ -0,0 +1,37 @@
+#include <iterator>
+
+#include "webview.hpp"
+
+WEBVIEW_MAIN {
+    wv::WebView w;
+
+    w.preEval(R"(
+        window.onload = function() {
+            window.external.invoke("loaded");
+        };
+    )");
+    w.setCallback([](wv::WebView &webview, std::string &) { webview.exit(); });
+
+    if (w.init() == -1) {
+        return 1;
+    }
+    while (w.run() == 0)
+        ;
+
+    // Every phase up to the finished load happened, in order
+    wv::StartupMetrics m = w.startupMetrics();
+    const wv::StartupMetrics::time_point phases[] = {
+        m.initStart,      m.gtkInit,        m.windowCreated,
+        m.contentManager, m.webViewCreated, m.navigate,
+        m.loadStarted,    m.loadCommitted,  m.loadFinished,
+    };
+    for (size_t i = 0; i < std::size(phases); i++) {
+        if (phases[i] == wv::StartupMetrics::time_point{} ||
+            (i > 0 && phases[i] < phases[i - 1])) {
+            return 1;
+        }
+    }
+
+    std::string trace = m.trace();
+    return trace.find("\"Load finished\"") != std::string::npos ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+#include "webview.hpp"
+
+WEBVIEW_MAIN {
+    wv::WebView w;
+    constexpr size_t total = 4 * 1024 * 1024;
+
+    std::shared_ptr<wv::Stream> stream;
+    size_t sent = 0;
+    bool backpressure = false;
+    bool passed = false;
+
+    // Writes until the stream is full, then waits for onDrain
+    auto pump = [&]() {
+        std::string chunk(10000, '\0');
+        while (sent < total) {
+            size_t n = std::min(chunk.size(), total - sent);
+            for (size_t i = 0; i < n; i++) {
+                chunk[i] = static_cast<char>((sent + i) % 251);
+            }
+            sent += n;
+            if (!stream->write(std::string_view(chunk).substr(0, n))) {
+                backpressure = true;
+                return;
+            }
+        }
+        stream->close();
+    };
+
+    w.setCallback([&](wv::WebView &webview, wv::String &arg) {
+        if (arg == Str("ready")) {
+            stream = webview.openStream(Str("data"), {16 * 1024, 64 * 1024});
+            stream->onDrain(pump);
+            pump();
+        } else if (arg == Str("done:4194304")) {
+            passed = backpressure;
+            webview.exit();
+        } else {
+            webview.exit();
+        }
+    });
+
+    w.preEval(Str(R"(
+        window.onload = async function() {
+            window.external.invoke('ready');
+            const stream = await window.external.stream('data');
+            let size = 0;
+            for (const reader = stream.getReader();;) {
+                const {done, value} = await reader.read();
+                if (done) break;
+                for (const byte of value) {
+                    if (byte !== size++ % 251) {
+                        window.external.invoke('corrupt');
+                        return;
+                    }
+                }
+            }
+            window.external.invoke('done:' + size);
+        };
+    )"));
+
+    if (w.init() == -1) {
+        return 1;
+    }
+
+    while (w.run() == 0)
+        ;
+
+    return passed ? 0 : 1;
+}
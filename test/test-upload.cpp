@@ -0,0 +1,70 @@
+#include "webview.hpp"
+
+constexpr char page[] = R"(<!DOCTYPE html>
+<html lang="en">
+<body>
+  <script type="text/javascript">
+    const body = new Uint8Array(16 * 1024 * 1024);
+    for (let i = 0; i < body.length; i++) body[i] = i % 251;
+    fetch('upload', { method: 'POST', body: new Blob([body]) })
+      .then(res => res.text())
+      .then(text => window.external.invoke(text));
+  </script>
+</body>
+</html>)";
+
+WEBVIEW_MAIN {
+#if !WEBKIT_CHECK_VERSION(2, 40, 0)
+    // Request bodies can't be read before WebKitGTK 2.40
+    return 0;
+#endif
+    wv::WebView w;
+    bool passed = false;
+    size_t size = 0;
+    size_t largestChunk = 0;
+    bool corrupt = false;
+
+    w.registerScheme("app", [](const wv::SchemeRequest &) {
+        wv::SchemeResponse res;
+        res.data = page;
+        res.size = sizeof(page) - 1;
+        return res;
+    });
+
+    w.registerUpload("app", [&](const wv::SchemeRequest &req) {
+        wv::UploadSink sink;
+        if (req.path != "/upload") {
+            return sink;
+        }
+
+        sink.onData = [&](std::string_view chunk) {
+            for (char c : chunk) {
+                corrupt |= static_cast<unsigned char>(c) != size++ % 251;
+            }
+            largestChunk = std::max(largestChunk, chunk.size());
+            return !corrupt;
+        };
+        sink.onEnd = [&]() {
+            return wv::SchemeResponse::fromString(std::to_string(size),
+                                                  "text/plain");
+        };
+        return sink;
+    });
+
+    w.navigate("app://local/index.html");
+
+    w.setCallback([&](wv::WebView &webview, wv::String &arg) {
+        // The body arrived whole, but never all at once
+        passed = arg == "16777216" && largestChunk < size;
+        webview.exit();
+    });
+
+    if (w.init() == -1) {
+        return 1;
+    }
+
+    while (w.run() == 0)
+        ;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+#include <map>
+
+#include "webview.hpp"
+
+WEBVIEW_MAIN {
+    wv::WebView w;
+    std::map<wv::String, int> received;
+
+    wv::UserScript start = w.addUserScript(
+        Str("window.external.invoke('start:' + document.readyState)"));
+    w.addUserScript(
+        Str("window.external.invoke('end:' + (document.body !== null))"),
+        wv::InjectTime::DocumentEnd);
+    w.preEval(Str(R"(
+        window.onload = function() {
+            window.external.invoke("ready");
+        };
+    )"));
+
+    w.setCallback([&](wv::WebView &webview, wv::String &arg) {
+        received[arg]++;
+        if (arg != Str("ready")) {
+            return;
+        }
+
+        if (received[arg] == 1) {
+            // Runs on this page right away, and on the next one
+            webview.addUserScript(Str("window.external.invoke('late')"));
+            webview.removeUserScript(start);
+            webview.navigate(Str("data:text/html,<p>Second page</p>"));
+        } else {
+            webview.exit();
+        }
+    });
+
+    if (w.init() == -1) {
+        return 1;
+    }
+
+    while (w.run() == 0)
+        ;
+
+    bool passed = received[Str("start:loading")] == 1 &&
+                  received[Str("end:true")] == 2 &&
+                  received[Str("late")] == 2 && !start.valid();
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+#include <filesystem>
+#include <string>
+
+#include "webview.hpp"
+
+WEBVIEW_MAIN {
+    namespace fs = std::filesystem;
+    fs::path dir = fs::temp_directory_path() / "webview-test-website-data";
+    fs::remove_all(dir);
+
+    wv::ContextOptions options;
+    options.dataDirectory = (dir / "data").string();
+    options.cacheDirectory = (dir / "cache").string();
+    options.diskCacheLimit = 64 * 1024 * 1024;
+    wv::WebView::setContextOptions(options);
+
+    wv::WebView w;
+    bool passed = false;
+    w.preEval(R"(
+        window.onload = function() {
+            window.external.invoke("loaded");
+        };
+    )");
+    w.setCallback([&](wv::WebView &webview, std::string &) {
+        // The disk cache lives in our directory, and can be cleared
+        const gchar *cache =
+            webkit_website_data_manager_get_disk_cache_directory(
+                webkit_web_context_get_website_data_manager(
+                    wv::WebView::webContext()));
+        bool inside = cache != nullptr &&
+                      std::string(cache).rfind(options.cacheDirectory, 0) == 0;
+        wv::WebView::clearWebsiteData(
+            WEBKIT_WEBSITE_DATA_ALL, {}, [&, inside](bool ok) {
+                passed = inside && ok;
+                webview.exit();
+            });
+    });
+
+    if (w.init() == -1) {
+        return 1;
+    }
+    while (w.run() == 0)
+        ;
+
+    fs::remove_all(dir);
+    return passed ? 0 : 1;
+}
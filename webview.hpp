@@ -24,8 +24,42 @@
 #endif
 
 // Headers
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <clocale>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <functional>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WEBVIEW_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 #if defined(WEBVIEW_WIN)
 #define WIN32_LEAN_AND_MEAN
@@ -36,10 +70,6 @@
 #include <windows.h>
 #include <winrt/Windows.Web.UI.Interop.h>
 
-#include <memory>
-#include <type_traits>
-#include <utility>
-
 #pragma warning(push)
 #pragma warning(disable : 4265)
 #include <winrt/Windows.Foundation.Collections.h>
@@ -57,9 +87,6 @@
 #include <wil/com.h>
 #include <windows.h>
 #include <wrl.h>
-
-#include <cstdlib>
-#include <utility>
 #elif defined(WEBVIEW_MAC)  // WEBVIEW_EDGE
 #import <Cocoa/Cocoa.h>
 #import <Webkit/Webkit.h>
@@ -78,8 +105,21 @@
 #include <JavaScriptCore/JavaScript.h>
 #include <gtk/gtk.h>
 #include <webkit2/webkit2.h>
+
+#include <filesystem>
 #endif
 
+// Declares an asset pack generated by webview_add_asset_pack() in CMake as
+// wv::AssetPack name_assets. Use at namespace scope.
+#define WEBVIEW_ASSET_PACK(name)                                           \
+    extern const size_t webview_assets_##name##_count;                     \
+    extern const size_t webview_assets_##name##_index[];                   \
+    extern const unsigned char webview_assets_##name##_blob[];             \
+    const wv::AssetPack name##_assets {                                    \
+        webview_assets_##name##_blob, webview_assets_##name##_index,       \
+            webview_assets_##name##_count                                  \
+    }
+
 constexpr auto DEFAULT_URL = Str(R"(data:text/html,
 <!DOCTYPE html>
 <html lang="en">
@@ -100,6 +140,7 @@ using String = std::wstring;
 #else
 using String = std::string;
 #endif
+using StringView = std::basic_string_view<String::value_type>;
 
 // Namespaces
 #if defined(WEBVIEW_WIN)
@@ -111,1040 +152,4951 @@ using namespace winrt::Windows::Web::UI::Interop;
 using namespace Microsoft::WRL;
 #endif
 
-class WebView {
-    using jscb = std::function<void(WebView&, String&)>;
-
-public:
-    WebView(int width_ = 800, int height_ = 600, bool resizable_ = true,
-            bool debug_ = true, const String& title_ = Str("Webview"),
-            const String& url_ = DEFAULT_URL)
-        : width(width_),
-          height(height_),
-          resizable(resizable_),
-          debug(debug_),
-          title(title_),
-          url(url_) {}
-    int init();                            // Initialize webview
-    void setCallback(jscb callback);       // JS callback
-    void setTitle(String t);               // Set title of window
-    void setFullscreen(bool fs);           // Set fullscreen
-    void setFullscreenFromJS(bool allow);  // Allow setting fullscreen from JS
-    void setBgColor(uint8_t r, uint8_t g, uint8_t b,
-                    uint8_t a);      // Set background color
-    bool run();                      // Main loop
-    void navigate(String u);         // Navigate to URL
-    void preEval(const String& js);  // Eval JS before page loads
-    void eval(const String& js);     // Eval JS
-    void css(const String& css);     // Inject CSS
-    void exit();                     // Stop loop
-
-private:
-    // Properties for init
-    int width;
-    int height;
-    bool resizable;
-    bool fullscreen = false;
-    bool fullscreenFromJS = false;
-    bool debug;
-    String title;
-    String url;
-
-    jscb js_callback;
-    bool init_done = false;  // Finished running init
-    uint8_t bgR = 255, bgG = 255, bgB = 255, bgA = 255;
-
-// Common Windows stuff
-#if defined(WEBVIEW_IS_WIN)
-    HWND hwnd = nullptr;
-    MSG msg{};  // Message from main loop
-    bool isFullscreen = false;
-    UINT dpi = USER_DEFAULT_SCREEN_DPI;
-
-    struct WindowInfo {
-        LONG_PTR style;    // GWL_STYLE
-        LONG_PTR exstyle;  // GWL_EXSTYLE
-        RECT rect;         // GetWindowRect
-    } savedWindowInfo{};
-
-    int WinInit();
-    void onDPIChange(const UINT dpi, const RECT& rect);
-    void resize();
-    static LRESULT CALLBACK WndProcedure(HWND hwnd, UINT msg, WPARAM wparam,
-                                         LPARAM lparam);
-#endif  // WEBVIEW_WIN || WEBVIEW_EDGE
-
-#if defined(WEBVIEW_WIN)
-    String inject =
-        Str("window.external.invoke=arg=>window.external.notify(arg);");
-    WebViewControl webview{nullptr};
-#elif defined(WEBVIEW_EDGE)  // WEBVIEW_WIN
-    String inject = Str(
-        "window.external.invoke=arg=>window.chrome.webview.postMessage(arg);");
-    wil::com_ptr<ICoreWebView2Controller>
-        webviewController;                      // Pointer to WebViewController
-    wil::com_ptr<ICoreWebView2> webviewWindow;  // Pointer to WebView window
-#elif defined(WEBVIEW_MAC)   // WEBVIEW_EDGE
-    String inject =
-        Str("window.external={invoke:arg=>window.webkit."
-            "messageHandlers.webview.postMessage(arg)};");
-    bool should_exit = false;  // Close window
-    NSAutoreleasePool* pool;
-    NSWindow* window;
-    WKWebView* webview;
-#elif defined(WEBVIEW_GTK)   // WEBVIEW_MAC
-    String inject =
-        Str("window.external={invoke:arg=>window.webkit."
-            "messageHandlers.external.postMessage(arg)};");
-    bool ready = false;        // Done loading page
-    bool js_busy = false;      // Currently in JS eval
-    bool should_exit = false;  // Close window
-    GtkWidget* window;
-    GtkWidget* webview;
-
-    static void external_message_received_cb(WebKitUserContentManager* m,
-                                             WebKitJavascriptResult* r,
-                                             gpointer arg);
-    static void webview_eval_finished(GObject* object, GAsyncResult* result,
-                                      gpointer arg);
-    static void webview_load_changed_cb(WebKitWebView* webview,
-                                        WebKitLoadEvent event, gpointer arg);
-    static void destroyWindowCb(GtkWidget* widget, gpointer arg);
-    // static gboolean closeWebViewCb(WebKitWebView *webView, GtkWidget
-    // *window);
-    static gboolean webview_context_menu_cb(
-        WebKitWebView* webview, GtkWidget* default_menu,
-        WebKitHitTestResult* hit_test_result, gboolean triggered_with_keyboard,
-        gpointer userdata);
-    static gboolean webview_enter_fullscreen_cb(WebKitWebView* webview,
-                                                gpointer userdata);
-    static gboolean webview_leave_fullscreen_cb(WebKitWebView* webview,
-                                                gpointer userdata);
-#endif                       // WEBVIEW_GTK
-};
+namespace json {
+template <typename T>
+size_t countTrailingZeros(T v) {
+#if defined(_MSC_VER)
+    unsigned long i;  // From <intrin.h>
+    if constexpr (sizeof(T) == 8) {
+        _BitScanForward64(&i, v);
+    } else {
+        _BitScanForward(&i, v);
+    }
+    return i;
+#else
+    if constexpr (sizeof(T) == 8) {
+        return static_cast<size_t>(__builtin_ctzll(v));
+    } else {
+        return static_cast<size_t>(__builtin_ctz(v));
+    }
+#endif
+}
 
-// Common Windows methods
-#if defined(WEBVIEW_IS_WIN)
-auto LoadLibraryPtr(LPCWSTR dll) {
-    // WIL alternative: wil::unique_hmodule(LoadLibrary(dll));
-    return std::unique_ptr<std::remove_pointer_t<HMODULE>,
-                           decltype(&::FreeLibrary)>(LoadLibrary(dll),
-                                                     FreeLibrary);
+constexpr bool isLittleEndian() {
+#if defined(__BYTE_ORDER__)
+    return __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+#else
+    return true;  // MSVC only targets little endian
+#endif
 }
 
-void setDPIAwareness() {
-    // Set default DPI awareness
-    auto user32 = LoadLibraryPtr(TEXT("User32.dll"));
-    auto pSPDAC =
-        GetProcNameAddress(user32.get(), SetProcessDpiAwarenessContext);
-    if (pSPDAC != nullptr) {
-        // Windows 10
-        pSPDAC(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2);
+// snprintf and strtod use the decimal point of the current locale, which
+// gtk_init sets from the environment, so e.g. de_DE has ',' where JSON
+// has '.'. Swaps one for the other in a formatted number.
+void swapDecimalPoint(std::string& number, bool toJson) {
+    std::string_view local = std::localeconv()->decimal_point;
+    if (local == ".") {
         return;
     }
-
-    auto shcore = LoadLibraryPtr(TEXT("ShCore.dll"));
-    auto pSPDA = GetProcNameAddress(shcore.get(), SetProcessDpiAwareness);
-    if (pSPDA != nullptr) {
-        // Windows 8.1
-        pSPDA(PROCESS_PER_MONITOR_DPI_AWARE);
-        return;
+    std::string_view from = toJson ? local : ".";
+    size_t i = number.find(from);
+    if (i != std::string::npos) {
+        number.replace(i, from.size(), toJson ? "." : local);
     }
+}
 
-    // Windows Vista
-    SetProcessDPIAware();  // Equivalent to DPI_AWARENESS_CONTEXT_SYSTEM_AWARE
+// Appends a Unicode code point as UTF-8 (or UTF-16 on Windows)
+void appendCodepoint(String& out, uint32_t cp) {
+    if constexpr (sizeof(String::value_type) == 1) {
+        if (cp < 0x80) {
+            out += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            out += static_cast<char>(0xC0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out += static_cast<char>(0xE0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    } else if (cp < 0x10000) {
+        out += static_cast<String::value_type>(cp);
+    } else {
+        cp -= 0x10000;
+        out += static_cast<String::value_type>(0xD800 | (cp >> 10));
+        out += static_cast<String::value_type>(0xDC00 | (cp & 0x3FF));
+    }
 }
 
-UINT getDPI(HWND hwnd) {
-    auto user32 = LoadLibraryPtr(TEXT("User32.dll"));
-    auto pGDFW = GetProcNameAddress(user32.get(), GetDpiForWindow);
-    if (pGDFW != nullptr) {
-        // Windows 10
-        return pGDFW(hwnd);
+// Returns the index of the first '"', '\' or control character in s at or
+// after pos, or s.size() if there is none. This is the inner loop of both
+// quoting and unquoting, so narrow strings are scanned 16 bytes at a time
+// with SSE2, or 8 at a time with plain integer ops elsewhere.
+size_t findSpecial(StringView s, size_t pos) {
+    if constexpr (sizeof(String::value_type) == 1) {
+        // Only a no-op for narrow strings, but this must compile for both
+        const char* data =
+            static_cast<const char*>(static_cast<const void*>(s.data()));
+#if defined(WEBVIEW_SSE2)
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(0x1F);
+        for (; pos + 16 <= s.size(); pos += 16) {
+            __m128i chunk = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(data + pos));
+            // Unsigned c <= 0x1F is the same as max(c, 0x1F) == 0x1F
+            __m128i special = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                             _mm_cmpeq_epi8(chunk, backslash)),
+                _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+            if (int mask = _mm_movemask_epi8(special); mask != 0) {
+                return pos + countTrailingZeros(static_cast<uint32_t>(mask));
+            }
+        }
+#else
+        // SWAR: flags a byte's high bit if it is zero (for x ^ pattern) or
+        // less than 0x20. The lowest flag is always exact.
+        constexpr uint64_t ones = 0x0101010101010101ull;
+        constexpr uint64_t highs = 0x8080808080808080ull;
+        for (; pos + 8 <= s.size(); pos += 8) {
+            uint64_t x;
+            std::memcpy(&x, data + pos, 8);
+            uint64_t q = x ^ (ones * '"');
+            uint64_t b = x ^ (ones * '\\');
+            uint64_t special = ((q - ones) & ~q) | ((b - ones) & ~b) |
+                               ((x - ones * 0x20) & ~x);
+            special &= highs;
+            if (special != 0 && isLittleEndian()) {
+                return pos + countTrailingZeros(special) / 8;
+            } else if (special != 0) {
+                break;  // Find the exact byte below
+            }
+        }
+#endif
     }
 
-    auto shcore = LoadLibraryPtr(TEXT("ShCore.dll"));
-    auto pGDFM = GetProcNameAddress(shcore.get(), GetDpiForMonitor);
-    if (pGDFM != nullptr) {
-        // Windows 8.1
-        UINT newDpi;
-        HMONITOR hmonitor = MonitorFromWindow(hwnd, MONITOR_DEFAULTTONEAREST);
-        HRESULT hr = pGDFM(hmonitor, MDT_EFFECTIVE_DPI, &newDpi, nullptr);
-        if (SUCCEEDED(hr)) {
-            return newDpi;
+    for (; pos < s.size(); pos++) {
+        auto c = s[pos];
+        if (c == '"' || c == '\\' || static_cast<uint32_t>(c) < 0x20) {
+            break;
         }
     }
+    return pos;
+}
 
-    // Windows 2000
-    if (HDC hdc = GetDC(hwnd)) {
-        auto dpi = GetDeviceCaps(hdc, LOGPIXELSX);
-        ReleaseDC(hwnd, hdc);
-        return dpi;
+// Appends s to out as a JSON string literal, which is also valid JS
+void quoteTo(String& out, StringView s) {
+    constexpr char hex[] = "0123456789abcdef";
+
+    out.reserve(out.size() + s.size() + 2);
+    out += '"';
+    size_t i = 0;
+    while (true) {
+        // Copy runs of plain characters in one go
+        size_t j = findSpecial(s, i);
+        out.append(s.data() + i, j - i);
+        if (j == s.size()) {
+            break;
+        }
+
+        auto c = s[j];
+        switch (c) {
+            case '"':
+                out += Str("\\\"");
+                break;
+            case '\\':
+                out += Str("\\\\");
+                break;
+            case '\n':
+                out += Str("\\n");
+                break;
+            case '\r':
+                out += Str("\\r");
+                break;
+            case '\t':
+                out += Str("\\t");
+                break;
+            default:
+                out += Str("\\u00");
+                out += hex[c >> 4];
+                out += hex[c & 0xF];
+        }
+        i = j + 1;
     }
+    out += '"';
+}
 
-    return USER_DEFAULT_SCREEN_DPI;
+// Quotes a string as a JSON string literal, which is also valid JS
+String quote(StringView s) {
+    String out;
+    quoteTo(out, s);
+    return out;
 }
 
-int WebView::WinInit() {
-    HINSTANCE hInt = GetModuleHandle(nullptr);
-    if (hInt == nullptr) {
-        return -1;
+// Parses the JSON string literal starting at s[pos] and appends it to out.
+// On success, pos is moved past the closing quote. Without out, the string
+// is only validated and skipped.
+bool unquote(StringView s, size_t& pos, String* out) {
+    if (pos >= s.size() || s[pos] != '"') {
+        return false;
     }
 
-    // Initialize Win32 window
-    WNDCLASSEX wc{};
-    wc.cbSize = sizeof(WNDCLASSEX);
-    wc.style = 0;
-    wc.lpfnWndProc = WndProcedure;
-    wc.cbClsExtra = 0;
-    wc.cbWndExtra = 0;
-    wc.hInstance = hInt;
-    wc.hIcon = LoadIcon(nullptr, IDI_APPLICATION);
-    wc.hCursor = LoadCursor(nullptr, IDC_ARROW);
-    wc.hbrBackground = (HBRUSH)(COLOR_WINDOW + 1);
-    wc.lpszMenuName = nullptr;
-    wc.lpszClassName = L"webview";
-    wc.hIconSm = LoadIcon(nullptr, IDI_APPLICATION);
+    auto hexValue = [&](size_t i, uint32_t& v) {
+        v = 0;
+        for (size_t j = i; j < i + 4; j++) {
+            if (j >= s.size()) return false;
+            auto c = s[j];
+            v <<= 4;
+            if (c >= '0' && c <= '9') {
+                v |= static_cast<uint32_t>(c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                v |= static_cast<uint32_t>(c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                v |= static_cast<uint32_t>(c - 'A' + 10);
+            } else {
+                return false;
+            }
+        }
+        return true;
+    };
 
-    if (!RegisterClassEx(&wc)) {
-        MessageBox(nullptr, L"Call to RegisterClassEx failed!", L"Error!",
-                   NULL);
+    for (size_t i = pos + 1; i < s.size(); i++) {
+        // Copy runs of plain characters in one go. Raw control characters
+        // aren't valid JSON, but are let through as is.
+        size_t j = i;
+        while ((j = findSpecial(s, j)) < s.size() && s[j] != '"' &&
+               s[j] != '\\') {
+            j++;
+        }
+        if (out != nullptr) {
+            out->append(s.data() + i, j - i);
+        }
+        if (j >= s.size()) {
+            return false;
+        }
 
-        return -1;
+        i = j;
+        if (s[i] == '"') {
+            pos = i + 1;
+            return true;
+        }
+
+        if (++i >= s.size()) return false;
+        String::value_type c;
+        switch (s[i]) {
+            case 'b':
+                c = '\b';
+                break;
+            case 'f':
+                c = '\f';
+                break;
+            case 'n':
+                c = '\n';
+                break;
+            case 'r':
+                c = '\r';
+                break;
+            case 't':
+                c = '\t';
+                break;
+            case 'u': {
+                uint32_t cp;
+                if (!hexValue(i + 1, cp)) return false;
+                i += 4;
+                // Combine surrogate pairs; a lone surrogate isn't a
+                // character
+                if (cp >= 0xDC00 && cp < 0xE000) return false;
+                if (cp >= 0xD800 && cp < 0xDC00) {
+                    uint32_t low;
+                    if (i + 6 >= s.size() || s[i + 1] != '\\' ||
+                        s[i + 2] != 'u' || !hexValue(i + 3, low) ||
+                        low < 0xDC00 || low >= 0xE000) {
+                        return false;
+                    }
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    i += 6;
+                }
+                if (out != nullptr) {
+                    appendCodepoint(*out, cp);
+                }
+                continue;
+            }
+            case '"':
+            case '\\':
+            case '/':
+                c = s[i];
+                break;
+            default:
+                return false;
+        }
+        if (out != nullptr) {
+            *out += c;
+        }
     }
+    return false;
+}
 
-    // Set default DPI awareness
-    setDPIAwareness();
+bool unquote(StringView s, size_t& pos, String& out) {
+    out.clear();
+    return unquote(s, pos, &out);
+}
 
-    hwnd = CreateWindow(L"webview", title.c_str(), WS_OVERLAPPEDWINDOW,
-                        CW_USEDEFAULT, CW_USEDEFAULT, width, height, nullptr,
-                        nullptr, hInt, nullptr);
+// Writes C++ values as JSON: bool, numbers, strings, std::vector and
+// std::optional (empty is null)
+void write(String& out, bool v) { out += v ? Str("true") : Str("false"); }
 
-    if (hwnd == nullptr) {
-        MessageBox(nullptr, L"Window Registration Failed!", L"Error!",
-                   MB_ICONEXCLAMATION | MB_OK);
-        return -1;
-    }
+void write(String& out, std::nullptr_t) { out += Str("null"); }
 
-    // Scale window based on DPI
-    dpi = getDPI(hwnd);
+void write(String& out, StringView v) { quoteTo(out, v); }
 
-    RECT rect = {};
-    GetWindowRect(hwnd, &rect);
-    SetWindowPos(hwnd, nullptr, rect.left, rect.top,
-                 MulDiv(width, dpi, USER_DEFAULT_SCREEN_DPI),
-                 MulDiv(height, dpi, USER_DEFAULT_SCREEN_DPI),
-                 SWP_NOZORDER | SWP_NOACTIVATE | SWP_FRAMECHANGED);
+void write(String& out, const String& v) { quoteTo(out, v); }
 
-    if (!resizable) {
-        auto style = GetWindowLongPtr(hwnd, GWL_STYLE);
-        style &= ~(WS_THICKFRAME | WS_MAXIMIZEBOX);
-        SetWindowLongPtr(hwnd, GWL_STYLE, style);
-    }
-
-    // Used with GetWindowLongPtr in WndProcedure
-    SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)this);
-    ShowWindow(hwnd, SW_SHOWDEFAULT);
-    UpdateWindow(hwnd);
-    SetFocus(hwnd);
+void write(String& out, const String::value_type* v) { quoteTo(out, v); }
 
-    return 0;
+template <typename T,
+          typename = std::enable_if_t<std::is_arithmetic_v<T> &&
+                                      !std::is_same_v<T, bool>>>
+void write(String& out, T v) {
+    char buf[32];
+    int len;
+    if constexpr (std::is_floating_point_v<T>) {
+        if (!std::isfinite(v)) {
+            out += Str("null");
+            return;
+        }
+        // Shortest of the two precisions that round-trips
+        double d = static_cast<double>(v);
+        len = std::snprintf(buf, sizeof(buf), "%.15g", d);
+        if (std::strtod(buf, nullptr) != d) {
+            len = std::snprintf(buf, sizeof(buf), "%.17g", d);
+        }
+        std::string number(buf, static_cast<size_t>(len));
+        swapDecimalPoint(number, true);
+        out.append(number.begin(), number.end());
+        return;
+    } else if constexpr (std::is_signed_v<T>) {
+        len = std::snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(v));
+    } else {
+        len = std::snprintf(buf, sizeof(buf), "%llu",
+                            static_cast<unsigned long long>(v));
+    }
+    out.append(buf, buf + len);
 }
 
-void WebView::setTitle(std::wstring t) {
-    if (!init_done) {
-        title = t;
+template <typename T>
+void write(String& out, const std::optional<T>& v) {
+    if (v) {
+        write(out, *v);
     } else {
-        SetWindowText(hwnd, t.c_str());
+        out += Str("null");
     }
 }
 
-// Adapted from
-// https://source.chromium.org/chromium/chromium/src/+/main:ui/views/win/fullscreen_handler.cc
-void WebView::setFullscreen(bool fs) {
-    if (isFullscreen == fs) return;
-
-    isFullscreen = fs;
-
-    if (fs) {
-        // Store window style before going fullscreen
-        savedWindowInfo.style = GetWindowLongPtr(hwnd, GWL_STYLE);
-        savedWindowInfo.exstyle = GetWindowLongPtr(hwnd, GWL_EXSTYLE);
-        GetWindowRect(hwnd, &savedWindowInfo.rect);
+template <typename T>
+void write(String& out, const std::vector<T>& v) {
+    out += '[';
+    for (size_t i = 0; i < v.size(); i++) {
+        if (i > 0) out += ',';
+        write(out, v[i]);
+    }
+    out += ']';
+}
 
-        // Set new window style
-        SetWindowLongPtr(hwnd, GWL_STYLE,
-                         savedWindowInfo.style & ~(WS_CAPTION | WS_THICKFRAME));
-        SetWindowLongPtr(
-            hwnd, GWL_EXSTYLE,
-            savedWindowInfo.exstyle & ~(WS_EX_DLGMODALFRAME | WS_EX_WINDOWEDGE |
-                                        WS_EX_CLIENTEDGE | WS_EX_STATICEDGE));
+// Unparsed JSON value, for decoding later or passing through as is
+struct Raw {
+    StringView json;
+};
 
-        // Get monitor size
-        MONITORINFO monitorInfo;
-        monitorInfo.cbSize = sizeof(monitorInfo);
-        GetMonitorInfo(MonitorFromWindow(hwnd, MONITOR_DEFAULTTONEAREST),
-                       &monitorInfo);
+void write(String& out, Raw v) { out += v.json; }
 
-        // Set window size to monitor size
-        SetWindowPos(hwnd, nullptr, monitorInfo.rcMonitor.left,
-                     monitorInfo.rcMonitor.top,
-                     monitorInfo.rcMonitor.right - monitorInfo.rcMonitor.left,
-                     monitorInfo.rcMonitor.bottom - monitorInfo.rcMonitor.top,
-                     SWP_NOZORDER | SWP_NOACTIVATE | SWP_FRAMECHANGED);
-    } else {
-        // Restore window style
-        SetWindowLongPtr(hwnd, GWL_STYLE, savedWindowInfo.style);
-        SetWindowLongPtr(hwnd, GWL_EXSTYLE, savedWindowInfo.exstyle);
+// Checks that s is a single well-formed JSON value
+bool validate(StringView s);
 
-        // Restore window size
-        SetWindowPos(hwnd, nullptr, savedWindowInfo.rect.left,
-                     savedWindowInfo.rect.top,
-                     savedWindowInfo.rect.right - savedWindowInfo.rect.left,
-                     savedWindowInfo.rect.bottom - savedWindowInfo.rect.top,
-                     SWP_NOZORDER | SWP_NOACTIVATE | SWP_FRAMECHANGED);
-    }
-}
+// Reads JSON values directly into C++ values in a single pass over the input.
+// Besides the types accepted by write, values can be read as a StringView
+// into the input (for strings without escapes) or as Raw.
+class Reader {
+public:
+    explicit Reader(StringView s_) : s(s_) {}
 
-bool WebView::run() {
-    bool loop = GetMessage(&msg, nullptr, 0, 0) > 0;
-    if (loop) {
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
+    bool done() {
+        skipSpace();
+        return pos == s.size();
     }
-    return !loop;
-}
 
-LRESULT CALLBACK WebView::WndProcedure(HWND hwnd, UINT msg, WPARAM wparam,
-                                       LPARAM lparam) {
-    WebView* w =
-        reinterpret_cast<WebView*>(GetWindowLongPtr(hwnd, GWLP_USERDATA));
+    // Reads the next value into out, converting it to out's type
+    template <typename T>
+    bool read(T& out) {
+        skipSpace();
+        if (pos >= s.size()) {
+            return false;
+        }
 
-    switch (msg) {
-        case WM_SIZE:
-            // WM_SIZE will first fire before the webview finishes loading
-            // init() calls resize(), so this call is only for size changes
-            // after fully loading.
-            if (w != nullptr && w->init_done) {
-                w->resize();
+        if constexpr (std::is_same_v<T, bool>) {
+            if (literal(Str("true"))) {
+                out = true;
+            } else if (literal(Str("false"))) {
+                out = false;
+            } else {
+                return false;
             }
-            return DefWindowProc(hwnd, msg, wparam, lparam);
-        case WM_DPICHANGED:
-            if (w != nullptr) {
-                // Resize on DPI change
-                UINT dpi = HIWORD(wparam);
-                const auto& rect = *reinterpret_cast<RECT*>(lparam);
-                w->onDPIChange(dpi, rect);
+            return true;
+        } else if constexpr (std::is_arithmetic_v<T>) {
+            return number(out);
+        } else if constexpr (std::is_same_v<T, String>) {
+            return unquote(s, pos, out);
+        } else if constexpr (std::is_same_v<T, StringView>) {
+            // A view into the input, only possible without escapes
+            size_t begin = pos;
+            if (!unquote(s, pos, nullptr)) return false;
+            out = s.substr(begin + 1, pos - begin - 2);
+            return out.find('\\') == StringView::npos;
+        } else if constexpr (std::is_same_v<T, Raw>) {
+            size_t begin = pos;
+            if (!skip()) return false;
+            out.json = s.substr(begin, pos - begin);
+            return true;
+        } else if constexpr (IsOptional<T>::value) {
+            if (literal(Str("null"))) {
+                out.reset();
+                return true;
             }
-            break;
-        case WM_DESTROY:
-            w->exit();
-            break;
-        default:
-            return DefWindowProc(hwnd, msg, wparam, lparam);
+            return read(out.emplace());
+        } else if constexpr (IsVector<T>::value) {
+            out.clear();
+            return readArray([&] { return read(out.emplace_back()); });
+        } else {
+            static_assert(sizeof(T) == 0, "Unsupported type for json::Reader");
+        }
     }
-    return 0;
-}
 
-void WebView::onDPIChange(const UINT newDpi, const RECT& rect) {
-    auto oldDpi = std::exchange(dpi, newDpi);
+    // Reads a JSON array into a tuple, one element per tuple member
+    template <typename... T>
+    bool read(std::tuple<T...>& out) {
+        if (!consume('[')) {
+            return false;
+        }
 
-    if (isFullscreen) {
-        // Scale the saved window size by the change in DPI
-        auto oldWidth = savedWindowInfo.rect.right - savedWindowInfo.rect.left;
-        auto oldHeight = savedWindowInfo.rect.bottom - savedWindowInfo.rect.top;
-        savedWindowInfo.rect.right =
-            savedWindowInfo.rect.left + MulDiv(oldWidth, newDpi, oldDpi);
-        savedWindowInfo.rect.bottom =
-            savedWindowInfo.rect.top + MulDiv(oldHeight, newDpi, oldDpi);
-    } else {
-        SetWindowPos(hwnd, nullptr, rect.left, rect.top, rect.right - rect.left,
-                     rect.bottom - rect.top,
-                     SWP_NOZORDER | SWP_NOACTIVATE | SWP_FRAMECHANGED);
+        bool ok = true;
+        size_t i = 0;
+        std::apply(
+            [&](auto&... elems) {
+                ((ok = ok && (i++ == 0 || consume(',')) && read(elems)), ...);
+            },
+            out);
+        return ok && consume(']');
     }
-}
-#endif
 
-#if defined(WEBVIEW_WIN)
-// Await helper
-template <typename T>
-auto block(T const& async) {
-    if (async.Status() != AsyncStatus::Completed) {
-        winrt::handle h(CreateEvent(nullptr, false, false, nullptr));
-        async.Completed([h = h.get()](auto, auto) { SetEvent(h); });
-        HANDLE hs[] = {h.get()};
-        DWORD i;
-        CoWaitForMultipleHandles(COWAIT_DISPATCH_WINDOW_MESSAGES |
-                                     COWAIT_DISPATCH_CALLS |
-                                     COWAIT_INPUTAVAILABLE,
-                                 INFINITE, 1, hs, &i);
+    // Reads an array one element at a time: readElem is called once per
+    // element and should read it (or skip it), returning false on errors.
+    // Reusing the same destination avoids allocating per element.
+    template <typename F>
+    bool readArray(F readElem) {
+        if (!consume('[')) return false;
+        if (consume(']')) return true;
+        do {
+            if (!readElem()) return false;
+        } while (consume(','));
+        return consume(']');
     }
-    return async.GetResults();
-}
 
-int WebView::init() {
-    if (auto res = WinInit(); res) {
-        return res;
-    }
+    // Skips over the next value of any type
+    bool skip() {
+        skipSpace();
+        if (pos >= s.size()) {
+            return false;
+        }
 
-    // Set to single-thread
-    init_apartment(winrt::apartment_type::single_threaded);
+        auto c = s[pos];
+        if (c == '"') {
+            return unquote(s, pos, nullptr);
+        } else if (c == '[') {
+            return readArray([&] { return skip(); });
+        } else if (c == '{') {
+            pos++;
+            if (consume('}')) return true;
+            do {
+                skipSpace();
+                if (!unquote(s, pos, nullptr) || !consume(':') || !skip()) {
+                    return false;
+                }
+            } while (consume(','));
+            return consume('}');
+        } else if (literal(Str("true")) || literal(Str("false")) ||
+                   literal(Str("null"))) {
+            return true;
+        }
+        double ignored;
+        return number(ignored);
+    }
 
-    // Allow intranet access (and localhost)
-    WebViewControlProcessOptions options;
-    options.PrivateNetworkClientServerCapability(
-        WebViewControlProcessCapabilityState::Enabled);
+    bool consume(String::value_type c) {
+        skipSpace();
+        if (pos < s.size() && s[pos] == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
 
-    WebViewControlProcess proc(options);
-    webview = block(proc.CreateWebViewControlAsync(
-        reinterpret_cast<int64_t>(hwnd), Rect()));
-    webview.Settings().IsScriptNotifyAllowed(true);
-    webview.ScriptNotify([this](const auto&, const auto& args) {
-        if (js_callback) {
-            std::wstring ws{args.Value()};
-            js_callback(*this, ws);
+private:
+    template <typename T>
+    struct IsOptional : std::false_type {};
+    template <typename T>
+    struct IsOptional<std::optional<T>> : std::true_type {};
+    template <typename T>
+    struct IsVector : std::false_type {};
+    template <typename T>
+    struct IsVector<std::vector<T>> : std::true_type {};
+
+    StringView s;
+    size_t pos = 0;
+
+    void skipSpace() {
+        while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\n' ||
+                                  s[pos] == '\r' || s[pos] == '\t')) {
+            pos++;
         }
-    });
-    webview.NavigationStarting([this](const auto&, const auto&) {
-        webview.AddInitializeScript(inject);
-    });
+    }
 
-    // Detect fullscreen request from JS
-    webview.ContainsFullScreenElementChanged([this](const auto&, const auto&) {
-        if (fullscreenFromJS) {
-            this->setFullscreen(webview.ContainsFullScreenElement());
+    bool literal(StringView word) {
+        if (s.substr(pos, word.size()) == word) {
+            pos += word.size();
+            return true;
         }
-    });
+        return false;
+    }
 
-    // Set webview bounds
-    resize();
+    template <typename T>
+    bool number(T& out) {
+        size_t begin = pos;
+        bool negative = pos < s.size() && s[pos] == '-';
+        if (negative) pos++;
 
-    webview.IsVisible(true);
+        auto isDigit = [&](size_t i) {
+            return i < s.size() && s[i] >= '0' && s[i] <= '9';
+        };
+        if (!isDigit(pos)) return false;
+        // JSON has no leading zeros
+        if (s[pos] == '0' && isDigit(pos + 1)) return false;
+
+        if constexpr (std::is_integral_v<T>) {
+            uint64_t value = 0;
+            while (isDigit(pos)) {
+                auto d = static_cast<uint64_t>(s[pos] - '0');
+                if (value > (std::numeric_limits<uint64_t>::max() - d) / 10) {
+                    return false;
+                }
+                value = value * 10 + d;
+                pos++;
+            }
+            if (pos < s.size() &&
+                (s[pos] == '.' || s[pos] == 'e' || s[pos] == 'E')) {
+                return false;
+            }
 
-    // Done initialization, set properties
-    init_done = true;
+            auto max = static_cast<uint64_t>((std::numeric_limits<T>::max)());
+            if (!negative) {
+                if (value > max) return false;
+                out = static_cast<T>(value);
+            } else if constexpr (std::is_unsigned_v<T>) {
+                if (value != 0) return false;
+                out = 0;
+            } else {
+                // The magnitude of min is max + 1, which doesn't fit in T,
+                // so negate value - 1 instead
+                if (value > max + 1) return false;
+                out = value == 0 ? T{0}
+                                 : static_cast<T>(
+                                       -static_cast<T>(value - 1) - 1);
+            }
+            return true;
+        } else {
+            // Accumulate up to 19 significant digits and a decimal exponent
+            uint64_t mantissa = 0;
+            int digits = 0;
+            int exponent = 0;
+            auto digit = [&](bool fraction) {
+                if (digits < 19) {
+                    mantissa =
+                        mantissa * 10 + static_cast<uint64_t>(s[pos] - '0');
+                    if (mantissa != 0) digits++;
+                    exponent -= fraction;
+                } else {
+                    exponent += !fraction;
+                }
+                pos++;
+            };
+
+            while (isDigit(pos)) digit(false);
+            if (pos < s.size() && s[pos] == '.') {
+                pos++;
+                if (!isDigit(pos)) return false;
+                while (isDigit(pos)) digit(true);
+            }
+            if (pos < s.size() && (s[pos] == 'e' || s[pos] == 'E')) {
+                pos++;
+                bool negExp = pos < s.size() && s[pos] == '-';
+                if (pos < s.size() && (s[pos] == '-' || s[pos] == '+')) pos++;
+                if (!isDigit(pos)) return false;
+                int e = 0;
+                while (isDigit(pos)) {
+                    e = std::min(e * 10 + (s[pos] - '0'), 10000);
+                    pos++;
+                }
+                exponent += negExp ? -e : e;
+            }
 
-    setTitle(title);
-    if (fullscreen) {
-        setFullscreen(true);
+            // Exact when both the mantissa and the power of 10 fit in a
+            // double (Clinger's fast path), otherwise fall back to strtod
+            // on the whole token
+            constexpr double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                         1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                         1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                         1e18, 1e19, 1e20, 1e21, 1e22};
+            double v;
+            if (mantissa <= (1ull << 53) && exponent >= -22 &&
+                exponent <= 22) {
+                v = static_cast<double>(mantissa);
+                v = exponent < 0 ? v / powers[-exponent] : v * powers[exponent];
+                v = negative ? -v : v;
+            } else {
+                std::string token(pos - begin, '\0');
+                for (size_t i = 0; i < token.size(); i++) {
+                    // ASCII by now; the cast is only a no-op for narrow
+                    // strings
+                    token[i] = static_cast<char>(
+                        static_cast<unsigned char>(s[begin + i]));
+                }
+                swapDecimalPoint(token, false);
+                v = std::strtod(token.c_str(), nullptr);
+            }
+            out = static_cast<T>(v);
+            return true;
+        }
     }
-    setBgColor(bgR, bgG, bgB, bgA);
-    navigate(url);
+};
 
-    return 0;
+bool validate(StringView s) {
+    Reader reader(s);
+    return reader.skip() && reader.done();
 }
+}  // namespace json
 
-void WebView::setFullscreenFromJS(bool allow) { fullscreenFromJS = allow; }
+namespace detail {
+// Return and argument types of a callable
+template <typename F>
+struct FunctionTraits : FunctionTraits<decltype(&F::operator())> {};
 
-void WebView::setBgColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
-    if (!init_done) {
-        bgR = r;
-        bgG = g;
-        bgB = b;
-        bgA = a;
-    } else {
-        webview.DefaultBackgroundColor({a, r, g, b});
+template <typename R, typename... Args>
+struct FunctionTraits<R (*)(Args...)> {
+    using Result = R;
+    using Params = std::tuple<std::decay_t<Args>...>;
+};
+
+template <typename C, typename R, typename... Args>
+struct FunctionTraits<R (C::*)(Args...)> : FunctionTraits<R (*)(Args...)> {};
+
+template <typename C, typename R, typename... Args>
+struct FunctionTraits<R (C::*)(Args...) const>
+    : FunctionTraits<R (*)(Args...)> {};
+
+// Lock-free multi-producer single-consumer queue (Vyukov). push() is one
+// atomic exchange, so producers never wait on each other or the consumer.
+template <typename T>
+class MPSCQueue {
+public:
+    MPSCQueue() : head(new Node), tail(head.load()) {}
+    ~MPSCQueue() {
+        T value;
+        while (pop(value)) {
+        }
+        delete tail;
+    }
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+    // Any thread
+    void push(T value) {
+        Node* node = new Node;
+        node->value = std::move(value);
+        Node* prev = head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
     }
-}
 
-void WebView::navigate(std::wstring u) {
-    if (!init_done) {
-        url = u;
-    } else if (constexpr auto prefix = L"data:text/html,";
-               u.rfind(prefix, 0) == 0) {
-        constexpr auto len = std::wstring_view(prefix).size();
-        webview.NavigateToString(u.substr(len));
-    } else {
-        Uri uri{u};
-        webview.Navigate(uri);
+    // Consumer thread only. May miss a push that hasn't finished linking
+    // its node yet, so producers must signal the consumer after pushing.
+    bool pop(T& value) {
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            return false;
+        }
+        value = std::move(next->value);
+        delete tail;
+        tail = next;  // next becomes the new (empty) sentinel
+        return true;
     }
-}
 
-void WebView::eval(const std::wstring& js) {
-    auto result = block(webview.InvokeScriptAsync(
-        L"eval", std::vector<winrt::hstring>({winrt::hstring(js)})));
+private:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        T value;
+    };
 
-    // if (debug) {
-    // std::cout << winrt::to_string(result) << std::endl;
-    //}
-}
+    std::atomic<Node*> head;  // Last pushed node
+    Node* tail;               // Sentinel before the first node
+};
 
-void WebView::exit() { PostQuitMessage(WM_QUIT); }
+// Appends the base64 encoding of data to out
+inline void base64Encode(std::string_view data, String& out) {
+    constexpr char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    auto byte = [&](size_t i) {
+        return static_cast<uint32_t>(static_cast<unsigned char>(data[i]));
+    };
 
-void WebView::resize() {
-    RECT rc;
-    GetClientRect(hwnd, &rc);
-    Rect bounds((float)rc.left, (float)rc.top, (float)(rc.right - rc.left),
-                (float)(rc.bottom - rc.top));
-    webview.Bounds(bounds);
+    out.reserve(out.size() + (data.size() + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 3 <= data.size(); i += 3) {
+        uint32_t n = byte(i) << 16 | byte(i + 1) << 8 | byte(i + 2);
+        out += static_cast<String::value_type>(digits[n >> 18]);
+        out += static_cast<String::value_type>(digits[(n >> 12) & 63]);
+        out += static_cast<String::value_type>(digits[(n >> 6) & 63]);
+        out += static_cast<String::value_type>(digits[n & 63]);
+    }
+    if (size_t rest = data.size() - i; rest > 0) {
+        uint32_t n = byte(i) << 16 | (rest == 2 ? byte(i + 1) << 8 : 0);
+        out += static_cast<String::value_type>(digits[n >> 18]);
+        out += static_cast<String::value_type>(digits[(n >> 12) & 63]);
+        out += rest == 2 ? digits[(n >> 6) & 63] : '=';
+        out += '=';
+    }
 }
-#elif defined(WEBVIEW_EDGE)  // WEBVIEW_WIN
-int WebView::init() {
-    if (auto res = WinInit(); res) {
-        return res;
+}  // namespace detail
+
+// Bump allocator for keeping data past a callback, e.g. the StringView a
+// message callback gets. Everything is freed at once by reset(), which
+// keeps the memory for reuse, so a steady workload stops allocating.
+class Arena {
+public:
+    explicit Arena(size_t blockSize_ = 64 * 1024) : blockSize(blockSize_) {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        while (current < blocks.size()) {
+            Block& block = blocks[current];
+            auto base = reinterpret_cast<uintptr_t>(block.data.get());
+            size_t start = (base + offset + align - 1) / align * align - base;
+            if (start + size <= block.size) {
+                offset = start + size;
+                return block.data.get() + start;
+            }
+            current++;
+            offset = 0;
+        }
+
+        // Oversized allocations get a block of their own
+        size_t bytes = std::max(blockSize, size + align);
+        blocks.push_back({std::make_unique<char[]>(bytes), bytes});
+        current = blocks.size() - 1;
+        offset = 0;
+        return allocate(size, align);
     }
 
-    // Set to single-thread
-    auto inithr = CoInitializeEx(
-        nullptr, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
-    if (FAILED(inithr)) {
-        return -1;
+    // Copy of s that lives until reset()
+    StringView copy(StringView s) {
+        auto data = static_cast<String::value_type*>(
+            allocate(s.size() * sizeof(String::value_type),
+                     alignof(String::value_type)));
+        std::copy(s.begin(), s.end(), data);
+        return {data, s.size()};
     }
 
-    auto onWebMessageReceieved =
-        [this](ICoreWebView2*, ICoreWebView2WebMessageReceivedEventArgs* args) {
-            if (js_callback) {
-                // Consider args->get_WebMessageAsJson?
-                LPWSTR messageRaw;
-                auto getMessageResult =
-                    args->TryGetWebMessageAsString(&messageRaw);
-                if (FAILED(getMessageResult)) {
-                    return getMessageResult;
-                }
+    void reset() {
+        current = 0;
+        offset = 0;
+    }
 
-                std::wstring message(messageRaw);
-                js_callback(*this, message);
-                CoTaskMemFree(messageRaw);
-            }
-            return S_OK;
-        };
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t blockSize;
+    size_t current = 0;  // Block being filled
+    size_t offset = 0;   // Used bytes in the current block
+};
+
+// Standard allocator backed by an Arena, for containers that live as long
+// as its contents. deallocate() is a no-op.
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    Arena* arena;
+
+    explicit ArenaAllocator(Arena& arena_) : arena(&arena_) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return arena == other.arena;
+    }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+        return arena != other.arena;
+    }
+};
+
+class WebView;
+
+// Limits for a stream opened with WebView::openStream
+struct StreamOptions {
+    size_t chunkSize = 64 * 1024;       // Largest chunk sent to JS at once
+    size_t highWaterMark = 1024 * 1024;  // Bytes buffered before write fails
+};
+
+// Byte stream from C++ to a ReadableStream in JS. Data is sent in chunks
+// only as fast as JS reads it, and write() reports when the producer
+// should wait for onDrain. Must be used on the UI thread.
+class Stream {
+public:
+    Stream(WebView& w_, uint64_t id_, StreamOptions options_)
+        : w(w_), id(id_), options(options_) {}
+    Stream(const Stream&) = delete;
+    Stream& operator=(const Stream&) = delete;
+
+    bool write(std::string_view data);  // False once highWaterMark is reached
+    void close();                       // Ends the stream after queued data
+    void onDrain(std::function<void()> callback);  // Room for more writes
+    size_t buffered() const { return queued + inFlight; }
+    bool cancelled() const { return isCancelled; }
+
+private:
+    friend class WebView;
+
+    WebView& w;
+    uint64_t id;
+    StreamOptions options;
+
+    std::deque<std::string> pending;  // Chunks not sent to JS yet
+    size_t queued = 0;                // Bytes in pending
+    size_t inFlight = 0;              // Bytes sent but not read by JS yet
+    bool full = false;                // write() returned false
+    bool closing = false;
+    bool isCancelled = false;
+    std::function<void()> drainCallback;
+
+    void send();  // Send pending chunks while JS has room
+    void ack(size_t size);
+    void cancel();
+};
+
+// JS side of streams. Each chunk is acknowledged once the ReadableStream
+// has room for it, formatted as "\x1d<id>:<bytes>", or "\x1d<id>:c" when
+// the reader cancels.
+constexpr auto streamRuntime = Str(
+    "window.__webview_stream={open:{},waiting:{},"
+    "get(name){const s=this.open[name];"
+    "if(s){delete this.open[name];return Promise.resolve(s);}"
+    "return new Promise(r=>(this.waiting[name]=this.waiting[name]||[]).push(r));"
+    "},"
+    "create(id,name,hwm){const send=m=>window.external.invoke('\x1d'+id+':'+m);"
+    "const s={unacked:0,send};"
+    "s.readable=new ReadableStream({start(c){s.c=c;},"
+    "pull(){if(s.unacked){send(s.unacked);s.unacked=0;}},"
+    "cancel(){send('c');}},{highWaterMark:hwm,size:u=>u.length});"
+    "this[id]=s;const w=this.waiting[name];"
+    "if(w&&w.length)w.shift()(s.readable);else this.open[name]=s.readable;},"
+    "chunk(id,b64){const s=this[id];if(!s)return;"
+    "const u=Uint8Array.from(atob(b64),c=>c.charCodeAt(0));s.c.enqueue(u);"
+    "if(s.c.desiredSize>0)s.send(u.length);else s.unacked+=u.length;},"
+    "close(id){const s=this[id];if(s){delete this[id];s.c.close();}}};"
+    "window.external.stream=name=>window.__webview_stream.get(name);");
+
+// Counters for async evals
+struct EvalStats {
+    size_t scripts = 0;  // Scripts passed to eval
+    size_t batches = 0;  // Scripts actually sent to the web engine
+};
+
+// Handle to a JS function registered with WebView::registerFunction
+class JSFunction {
+public:
+    JSFunction() = default;
+    bool valid() const { return id != 0; }
+
+private:
+    friend class WebView;
+    explicit JSFunction(uint64_t id_) : id(id_) {}
+
+    uint64_t id = 0;
+};
+
+// When a user script runs
+enum class InjectTime {
+    DocumentStart,  // Before any of the page's own scripts
+    DocumentEnd,    // Once the document is parsed, before subresources load
+};
+
+// Which frames a user script runs in
+enum class InjectFrames {
+    TopFrame,
+    AllFrames,
+};
+
+// Handle to a script added with WebView::addUserScript
+class UserScript {
+public:
+    UserScript() = default;
+    bool valid() const { return id != 0; }
+
+private:
+    friend class WebView;
+    explicit UserScript(uint64_t id_) : id(id_) {}
+
+    uint64_t id = 0;
+};
+
+// Handle to a stylesheet added with WebView::addStyleSheet
+class StyleSheet {
+public:
+    StyleSheet() = default;
+    bool valid() const { return id != 0; }
+
+private:
+    friend class WebView;
+    explicit StyleSheet(uint64_t id_) : id(id_) {}
+
+    uint64_t id = 0;
+};
+
+// How tasks handed to a WorkerPool are ordered
+enum class Ordering {
+    Unordered,   // Tasks may run at the same time and finish in any order
+    PerChannel,  // Tasks on the same channel run one at a time, in order
+};
+
+// Fixed-size thread pool. Each worker has its own queue and steals from the
+// others when it runs dry. The number of tasks waiting to start is bounded,
+// so a flood of calls fails fast instead of piling up. Tasks must not throw.
+class WorkerPool {
+public:
+    using Task = std::function<void()>;
+
+    // threads = 0 uses one thread per core
+    explicit WorkerPool(size_t threads = 0, size_t maxQueued = 1024);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    size_t size() const { return workers.size(); }
+    bool submit(Task task);  // Returns false if the queue is full
+    bool submit(const String& channel, Task task);  // Same, ordered by channel
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    // Tasks of one channel, run by a single task that re-queues itself
+    struct Channel {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        bool running = false;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    size_t maxQueued;
+    std::atomic<size_t> queued{0};  // Submitted tasks that haven't started
+    std::atomic<size_t> ready{0};   // Tasks sitting in worker queues
+    std::atomic<size_t> next{0};    // Round-robin worker for new tasks
+
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    std::mutex channelsMutex;
+    std::unordered_map<String, std::shared_ptr<Channel>> channels;
+
+    bool reserve();  // Count a task against maxQueued
+    void push(Task task);
+    bool pop(size_t index, Task& task);
+    void runChannel(const std::shared_ptr<Channel>& channel);
+    void work(size_t index);
+};
+
+// Read-only set of files generated by webview_add_asset_pack() in CMake.
+// Declare one with WEBVIEW_ASSET_PACK(name), which defines name_assets.
+class AssetPack {
+public:
+    struct Asset {
+        std::string_view path;
+        std::string_view mime;
+        const unsigned char* data;
+        size_t size;
+        bool gzip;  // data is gzip-compressed
+    };
+
+    AssetPack(const unsigned char* blob_, const size_t* index_, size_t count_)
+        : blob(blob_), index(index_), count(count_) {}
+
+    size_t size() const { return count; }
+
+    Asset at(size_t i) const {
+        const size_t* entry = index + i * 7;
+        return {{reinterpret_cast<const char*>(blob + entry[0]), entry[1]},
+                {reinterpret_cast<const char*>(blob + entry[2]), entry[3]},
+                blob + entry[4],
+                entry[5],
+                entry[6] != 0};
+    }
+
+    // Binary search over the index, which is sorted by path
+    std::optional<Asset> find(std::string_view path) const {
+        size_t lo = 0;
+        size_t hi = count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            Asset asset = at(mid);
+            if (asset.path < path) {
+                lo = mid + 1;
+            } else if (path < asset.path) {
+                hi = mid;
+            } else {
+                return asset;
+            }
+        }
+        return std::nullopt;
+    }
+
+private:
+    const unsigned char* blob;
+    const size_t* index;
+    size_t count;
+};
+
+#if defined(WEBVIEW_GTK)
+// Request made to a custom URI scheme
+struct SchemeRequest {
+    std::string uri;     // Full URI, e.g. app://host/index.html
+    std::string path;    // Path of the URI, e.g. /index.html
+    std::string method;  // HTTP method, e.g. GET
+};
+
+// Response to a custom URI scheme request. The body is not copied: data must
+// stay valid until the web engine is done with it, either because it's static
+// or because owner keeps it alive.
+struct SchemeResponse {
+    const void* data = nullptr;
+    size_t size = 0;
+    std::shared_ptr<const void> owner;
+    std::string mime = "text/html";
+    int status = 200;
+    bool gzip = false;  // Body is gzip-compressed
+
+    // Takes ownership of a string as the body
+    static SchemeResponse fromString(std::string body,
+                                     std::string mime = "text/html") {
+        auto owned = std::make_shared<const std::string>(std::move(body));
+        SchemeResponse res;
+        res.data = owned->data();
+        res.size = owned->size();
+        res.owner = std::move(owned);
+        res.mime = std::move(mime);
+        return res;
+    }
+};
+
+// Receives the body of a request to a custom URI scheme one chunk at a
+// time. A chunk is only valid during the call to onData.
+struct UploadSink {
+    std::function<bool(std::string_view chunk)> onData;  // false aborts
+    std::function<SchemeResponse()> onEnd;  // Whole body received
+    std::function<void(const std::string& error)> onError;
+};
+
+// Responses to custom URI scheme requests, kept in memory and shared by
+// every WebView that serves from it. Bodies are stored once per SHA-256 of
+// their content, however many URLs return them, and the least recently used
+// are dropped once the cache holds more than its limit. Use it from the UI
+// thread, where scheme handlers run.
+class ResponseCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;  // Bodies dropped to stay within the limit
+        size_t urls = 0;
+        size_t bodies = 0;
+        size_t bytes = 0;  // Size of the bodies
+    };
+
+    explicit ResponseCache(size_t maxBytes = 64 * 1024 * 1024);
+
+    // A response that shares the cached body, counting a hit or a miss
+    std::optional<SchemeResponse> lookup(const std::string& url);
+    void store(const std::string& url, const SchemeResponse& res);
+    void clear();
+    Stats stats() const;
+
+private:
+    struct Body {
+        std::shared_ptr<const std::string> data;
+        std::string mime;
+        bool gzip;
+        std::vector<std::string> urls;      // Returning this body
+        std::list<std::string>::iterator lru;
+    };
+
+    size_t maxBytes;
+    std::unordered_map<std::string, std::string> urls;  // To the hash
+    std::unordered_map<std::string, Body> bodies;       // By hash
+    std::list<std::string> lru;  // Hashes, most recently used first
+    Stats counters;
+
+    void unlink(const std::string& url);  // Drop url, and its body if unused
+    void erase(std::string hash);         // Drop a body and its urls
+};
+
+// Settings of the web context shared by every WebView in the process. The
+// defaults are WebKit's own.
+struct ContextOptions {
+    WebKitCacheModel cacheModel = WEBKIT_CACHE_MODEL_WEB_BROWSER;
+
+    // Ignored by WebKitGTK 2.26 and newer, see WebView::shareWebProcess
+    WebKitProcessModel processModel =
+        WEBKIT_PROCESS_MODEL_MULTIPLE_SECONDARY_PROCESSES;
+    unsigned webProcessLimit = 0;  // 0 for no limit
+
+    // When web processes start freeing memory, 0 for WebKit's defaults.
+    // Needs WebKitGTK 2.34 or newer.
+    unsigned memoryLimit = 0;          // In MiB
+    double conservativeThreshold = 0;  // Fraction of memoryLimit
+    double strictThreshold = 0;        // Fraction of memoryLimit
+    double pollInterval = 0;           // In seconds
+
+    // Website data kept between runs, so pages start warm. Empty for
+    // WebKit's defaults, which are named after the program.
+    std::string dataDirectory;    // Local storage, IndexedDB, cookies...
+    std::string cacheDirectory;   // HTTP disk cache
+    uint64_t diskCacheLimit = 0;  // In bytes, 0 for none. Checked at startup.
+    bool ephemeral = false;       // Keep nothing on disk
+
+    static ContextOptions kiosk();      // One long-lived app page
+    static ContextOptions dashboard();  // Many panes open at once
+    static ContextOptions lowMemory();  // Smallest footprint
+};
+
+// Monotonic timestamps of the phases of init() and the first page load.
+// Phases that didn't happen (yet) are time_point{}.
+struct StartupMetrics {
+    using time_point = std::chrono::steady_clock::time_point;
+
+    time_point initStart;       // init() called
+    time_point gtkInit;         // gtk_init_check() returned
+    time_point windowCreated;   // Window and scroller created
+    time_point contentManager;  // Content manager set up
+    time_point webViewCreated;  // Web view created, scripts added
+    time_point navigate;        // First page requested
+    time_point loadStarted;     // First load-changed events
+    time_point loadCommitted;
+    time_point loadFinished;
+    time_point firstPaint;  // First frame drawn after the load committed
+
+    std::string trace() const;  // Chrome trace event JSON
+};
+
+// Part of the page a snapshot covers
+enum class SnapshotRegion {
+    Visible,       // What the window shows
+    FullDocument,  // The whole page, scrolled out parts included
+};
+
+// Pixels in cairo's ARGB32 format: premultiplied BGRA in memory on little
+// endian machines, rows stride bytes apart
+struct Bitmap {
+    uint8_t* data = nullptr;
+    int width = 0;
+    int height = 0;
+    int stride = 0;  // Bytes per row, at least width * 4, a multiple of 4
+};
+
+enum class RenderFormat { Png, Pdf };
+
+// Document for BatchRenderer to render into a file
+struct RenderJob {
+    std::string url;   // Page to load, e.g. a data: URL
+    std::string html;  // Or the document itself, when url is empty
+    std::string output;  // Path of the file to write
+    RenderFormat format = RenderFormat::Png;
+};
+
+struct RenderOptions {
+    size_t views = 4;  // Documents rendered at once
+    int width = 1024;  // Viewport of each view
+    int height = 768;
+    bool waitForSignal = false;  // Also wait for the page's renderReady()
+    std::chrono::milliseconds timeout{30000};  // Per document
+};
+
+struct RenderStats {
+    size_t rendered = 0;
+    size_t failed = 0;
+    double seconds = 0;
+
+    double docsPerSecond() const {
+        return seconds > 0 ? static_cast<double>(rendered) / seconds : 0;
+    }
+};
+#endif
+
+class WebView {
+    using jscb = std::function<void(WebView&, String&)>;
+    using viewcb = std::function<void(WebView&, StringView)>;
+    using evalcb = std::function<void(WebView&, bool, String&)>;
+    using rpccb = std::function<void(WebView&, StringView, StringView)>;
+    using dispatchcb = std::function<void(WebView&)>;
+#if defined(WEBVIEW_GTK)
+    using schemecb = std::function<SchemeResponse(const SchemeRequest&)>;
+    using uploadcb = std::function<UploadSink(const SchemeRequest&)>;
+    using snapshotcb = std::function<void(WebView&, bool, const Bitmap&)>;
+    using printcb = std::function<void(WebView&, bool)>;
+    using clearcb = std::function<void(bool)>;
+#endif
+
+public:
+    WebView(int width_ = 800, int height_ = 600, bool resizable_ = true,
+            bool debug_ = true, const String& title_ = Str("Webview"),
+            const String& url_ = DEFAULT_URL)
+        : width(width_),
+          height(height_),
+          resizable(resizable_),
+          debug(debug_),
+          title(title_),
+          url(url_) {
+        inject += streamRuntime;
+    }
+#if defined(WEBVIEW_GTK)
+    ~WebView();  // Destroys the window
+#endif
+    int init();                            // Initialize webview
+    // JS callback. A callback taking a StringView gets the engine's buffer
+    // without a copy, valid until it returns.
+    template <typename F>
+    void setCallback(F callback) {
+        if constexpr (std::is_invocable_v<F&, WebView&, StringView>) {
+            view_callback = std::move(callback);
+            js_callback = nullptr;
+        } else {
+            js_callback = std::move(callback);
+            view_callback = nullptr;
+        }
+    }
+    void setTitle(String t);               // Set title of window
+    void setFullscreen(bool fs);           // Set fullscreen
+    void setVisible(bool visible);         // Show or hide window
+    void setFullscreenFromJS(bool allow);  // Allow setting fullscreen from JS
+    void setBgColor(uint8_t r, uint8_t g, uint8_t b,
+                    uint8_t a);      // Set background color
+    bool run();                      // Main loop
+    bool runFor(std::chrono::milliseconds timeout);  // Main loop, bounded
+    bool poll();                                     // Main loop, no waiting
+    void navigate(String u);         // Navigate to URL
+    void preEval(const String& js);  // Eval JS before page loads
+    UserScript addUserScript(
+        const String& js, InjectTime time = InjectTime::DocumentStart,
+        InjectFrames frames = InjectFrames::TopFrame);  // Eval JS on each page
+    void removeUserScript(UserScript& script);
+    void eval(const String& js);     // Eval JS
+    void eval(const String& js, evalcb callback);  // Eval JS asynchronously
+    void setEvalBatching(bool batch);  // Coalesce async evals per iteration
+    EvalStats evalStats() const;       // Async eval counters
+    void css(const String& css);     // Inject CSS
+    void exit();                     // Stop loop
+
+    // User stylesheets, applied to this and future pages before they paint
+    StyleSheet addStyleSheet(const String& css);
+    void replaceStyleSheet(const StyleSheet& sheet, const String& css);
+    void removeStyleSheet(StyleSheet& sheet);
+
+    // Define a JS function once, on this and future pages
+    JSFunction registerFunction(const String& source);
+    void unregisterFunction(JSFunction& fn);
+
+    // Call a registered function with JSON encoded args
+    template <typename... Args>
+    void call(const JSFunction& fn, const Args&... args) {
+        callWithResult(fn, nullptr, args...);
+    }
+
+    // Like call, but callback gets the JSON encoded result
+    template <typename... Args>
+    void callWithResult(const JSFunction& fn, evalcb callback,
+                        const Args&... args) {
+        String argv = Str("[");
+        ((json::write(argv, args), argv += ','), ...);
+        if (argv.size() > 1) {
+            argv.pop_back();
+        }
+        argv += ']';
+        callFunction(fn, argv, std::move(callback));
+    }
+
+    // Expose fn to JS as window.name(...), which returns a Promise
+    template <typename F>
+    void bind(const String& name, F fn) {
+        addBinding(name, [fn = std::move(fn)](WebView& w, StringView id,
+                                              StringView args) mutable {
+            String result;
+            bool ok = callBinding(fn, args, result);
+            w.settleCall(id, ok, result);
+        });
+    }
+
+    // Like bind, but fn runs on the worker pool instead of the UI thread
+    template <typename F>
+    void bindAsync(const String& name, F fn,
+                   Ordering ordering = Ordering::PerChannel) {
+        auto shared = std::make_shared<std::decay_t<F>>(std::move(fn));
+
+        addBinding(name, [shared, name, ordering](WebView& w, StringView id,
+                                                  StringView args) {
+            auto task = [&w, shared, id = String(id), args = String(args)]() {
+                String result;
+                bool ok = callBinding(*shared, args, result);
+                w.dispatch([id, ok, result = std::move(result)](WebView& view) {
+                    view.settleCall(id, ok, result);
+                });
+            };
+
+            WorkerPool& pool = w.workerPool();
+            bool queued = ordering == Ordering::PerChannel
+                              ? pool.submit(name, std::move(task))
+                              : pool.submit(std::move(task));
+            if (!queued) {
+                w.settleCall(id, false,
+                             json::quote(Str("Worker queue is full")));
+            }
+        });
+    }
+    void setWorkers(size_t threads,
+                    size_t maxQueued = 1024);  // Configure the worker pool
+    void unbind(const String& name);           // Remove a binding
+    std::shared_ptr<Stream> openStream(
+        const String& name, StreamOptions options = {});  // Stream to JS
+    void dispatch(dispatchcb fn);  // Run fn on the UI thread, from any thread
+#if defined(WEBVIEW_GTK)
+    void registerScheme(const String& scheme,
+                        schemecb handler);  // Serve a custom URI scheme
+    void serveAssets(const String& scheme,
+                     const AssetPack& assets);  // Serve an asset pack
+    void serveCached(const String& scheme,
+                     std::shared_ptr<ResponseCache> cache,
+                     schemecb fetch);  // Serve a scheme through a cache
+    void registerUpload(const String& scheme,
+                        uploadcb handler);  // Stream request bodies
+    int pollFds(std::vector<GPollFD>& fds);  // Fds for an external loop
+    bool dispatchFds(std::vector<GPollFD>& fds);  // Run what fds woke up
+    void shareWebProcess(WebView& other);  // Render in other's web process
+    void setHeadless(bool headless);  // Before init, render offscreen
+    static WebKitWebContext* webContext();  // Shared by every WebView
+    static bool setContextOptions(
+        const ContextOptions& options);  // Before the first init
+    static void clearWebsiteData(
+        int types, std::chrono::seconds modifiedWithin = {},
+        clearcb done = nullptr);  // Remove WEBKIT_WEBSITE_DATA_* types
+    static uint64_t cacheSize();  // Bytes in the disk cache
+    static void pruneCache(uint64_t limit,
+                           clearcb done = nullptr);  // Clear if over limit
+    StartupMetrics startupMetrics() const;  // Time spent starting up
+    void snapshot(SnapshotRegion region, snapshotcb callback,
+                  Bitmap target = {});  // Page pixels, into target if set
+    void printToPdf(const String& path,
+                    printcb callback);  // Print the page to a PDF file
+#endif
+
+private:
+    // Properties for init
+    int width;
+    int height;
+    bool resizable;
+    bool fullscreen = false;
+    bool fullscreenFromJS = false;
+    bool visible = true;
+    bool debug;
+    String title;
+    String url;
+
+    jscb js_callback;
+    viewcb view_callback;
+    bool init_done = false;  // Finished running init
+
+    // Async evals waiting for the next run() iteration
+    bool batchEvals = false;
+    std::vector<std::pair<String, evalcb>> evalQueue;
+    EvalStats stats;
+
+    void runScript(const String& js, evalcb callback);  // Platform async eval
+    void flushEvals();  // Send queued evals as one script
+
+    // User scripts in the order they run
+    struct UserScriptSource {
+        String js;
+        InjectTime time;
+        InjectFrames frames;
+    };
+    uint64_t lastUserScriptId = 0;
+    std::map<uint64_t, UserScriptSource> userScripts;
+
+    void updateUserScript(uint64_t id);  // Platform: apply a change
+
+    // Registered functions, with the script that defines each one
+    uint64_t lastFunctionId = 0;
+    std::unordered_map<uint64_t, UserScript> functions;
+
+    void callFunction(const JSFunction& fn, const String& args,
+                      evalcb callback);
+
+    // User stylesheets in the order they cascade
+    uint64_t lastStyleSheetId = 0;
+    std::map<uint64_t, String> styleSheets;
+
+    void updateStyleSheet(uint64_t id);  // Platform: apply a change
+#if !defined(WEBVIEW_GTK)
+    String injectScript() const;  // inject, user scripts and stylesheets
+    void addInjectScript();       // Platform: (re)install it for new pages
+#endif
+
+    // Bound functions, keyed by a view of their own name
+    struct Binding {
+        String name;
+        rpccb fn;
+        UserScript stub;  // Defines window[name] on each page
+    };
+    std::unordered_map<StringView, std::unique_ptr<Binding>> bindings;
+    bool rpcInjected = false;  // Added the JS side of bindings
+
+    void addBinding(const String& name, rpccb fn);
+    void settleCall(StringView id, bool ok, const String& json);
+    void onMessage(StringView msg);  // Route a message from JS
+
+    // Decode JSON args, call fn and encode its result or error as JSON
+    template <typename F>
+    static bool callBinding(F& fn, StringView args, String& result) {
+        using Traits = detail::FunctionTraits<std::decay_t<F>>;
+
+        typename Traits::Params params;
+        json::Reader reader(args);
+        if (!reader.read(params) || !reader.done()) {
+            result = json::quote(Str("Invalid arguments"));
+            return false;
+        }
+
+        try {
+            if constexpr (std::is_void_v<typename Traits::Result>) {
+                std::apply(fn, std::move(params));
+                result = Str("undefined");
+            } else {
+                json::write(result, std::apply(fn, std::move(params)));
+            }
+            return true;
+        } catch (const std::exception& e) {
+            std::string what = e.what();
+            result = json::quote(String(what.begin(), what.end()));
+            return false;
+        }
+    }
+
+    // Open streams, until closed and fully read or cancelled
+    friend class Stream;
+    uint64_t lastStreamId = 0;
+    std::unordered_map<uint64_t, std::shared_ptr<Stream>> streams;
+
+    void onStreamMessage(StringView msg);
+
+    // Functions dispatched from other threads, run on the UI thread. Only
+    // the first dispatch after a drain wakes the UI thread up.
+    detail::MPSCQueue<dispatchcb> dispatched;
+    std::atomic<bool> wakePending{false};
+    static constexpr size_t maxDispatchPerWakeup = 4096;
+
+    void runDispatched();
+    void wakeUp();  // Platform: make the UI thread call runDispatched()
+
+    // Declared after everything its tasks use, so it's joined first
+    std::unique_ptr<WorkerPool> workers;
+    WorkerPool& workerPool();  // Created on first use
+    uint8_t bgR = 255, bgG = 255, bgB = 255, bgA = 255;
+
+// Common Windows stuff
+#if defined(WEBVIEW_IS_WIN)
+    HWND hwnd = nullptr;
+    MSG msg{};  // Message from main loop
+    bool isFullscreen = false;
+    UINT dpi = USER_DEFAULT_SCREEN_DPI;
+
+    struct WindowInfo {
+        LONG_PTR style;    // GWL_STYLE
+        LONG_PTR exstyle;  // GWL_EXSTYLE
+        RECT rect;         // GetWindowRect
+    } savedWindowInfo{};
+
+    int WinInit();
+    void onDPIChange(const UINT dpi, const RECT& rect);
+    void resize();
+    static LRESULT CALLBACK WndProcedure(HWND hwnd, UINT msg, WPARAM wparam,
+                                         LPARAM lparam);
+#endif  // WEBVIEW_WIN || WEBVIEW_EDGE
+
+#if defined(WEBVIEW_WIN)
+    String inject =
+        Str("window.external.invoke=arg=>window.external.notify(arg);");
+    // InvokeScriptAsync only returns strings, so serialize results to JSON
+    // like the other platforms do
+    static constexpr auto evalHelper =
+        Str("window.__webview_eval=js=>{"
+            "const r=JSON.stringify((0,eval)(js));"
+            "return r===undefined?'null':r;};");
+    WebViewControl webview{nullptr};
+#elif defined(WEBVIEW_EDGE)  // WEBVIEW_WIN
+    String inject = Str(
+        "window.external.invoke=arg=>window.chrome.webview.postMessage(arg);");
+    wil::com_ptr<ICoreWebView2Controller>
+        webviewController;                      // Pointer to WebViewController
+    wil::com_ptr<ICoreWebView2> webviewWindow;  // Pointer to WebView window
+    std::wstring injectScriptId;                // Once added, to replace it
+    uint64_t injectScriptVersion = 0;
+#elif defined(WEBVIEW_MAC)   // WEBVIEW_EDGE
+    String inject =
+        Str("window.external={invoke:arg=>window.webkit."
+            "messageHandlers.webview.postMessage(arg)};");
+    bool should_exit = false;  // Close window
+    NSAutoreleasePool* pool;
+    NSWindow* window;
+    WKWebView* webview;
+#elif defined(WEBVIEW_GTK)   // WEBVIEW_MAC
+    String inject =
+        Str("window.external={invoke:arg=>window.webkit."
+            "messageHandlers.external.postMessage(arg)};");
+    bool ready = false;        // Done loading page
+    bool js_busy = false;      // Currently in JS eval
+    bool should_exit = false;  // Close window
+    GtkWidget* window = nullptr;   // nullptr once destroyed
+    GtkWidget* webview = nullptr;
+    WebView* relatedView = nullptr;  // From shareWebProcess
+
+    // Tells BatchRenderer which page messages come from
+    friend class BatchRenderer;
+    dispatchcb onCommitted;  // Each time a new page is committed
+    bool headless = false;           // Offscreen window, never mapped
+
+    // Cancelled on destruction, so async evals don't call back into it
+    GCancellable* cancellable = g_cancellable_new();
+
+    StartupMetrics metrics;
+    GdkFrameClock* paintClock = nullptr;  // Waiting for the first paint
+    gulong paintHandler = 0;
+
+    static void markPhase(StartupMetrics::time_point& phase);
+    void dumpStartupTrace() const;  // To $WEBVIEW_STARTUP_TRACE, if set
+    static void webview_after_paint_cb(GdkFrameClock* clock, gpointer arg);
+
+    // Created by the first init
+    static inline WebKitWebContext* sharedContext = nullptr;
+    static inline ContextOptions contextOptions;
+
+    // Async evals waiting for the page to finish loading
+    std::vector<std::pair<String, evalcb>> pendingEvals;
+
+    struct EvalRequest {
+        WebView* w;
+        evalcb callback;
+    };
+
+    struct SnapshotRequest {
+        WebView* w;
+        snapshotcb callback;
+        Bitmap target;
+    };
+
+    struct PrintRequest {
+        WebView* w;  // nullptr once the WebView is gone
+        printcb callback;
+        bool failed = false;
+    };
+    std::vector<PrintRequest*> prints;  // In progress
+
+    // Native copies of userScripts and styleSheets, created once the view
+    // exists, so each one is only handed to WebKit once
+    std::map<uint64_t, WebKitUserScript*> nativeUserScripts;
+    std::map<uint64_t, WebKitUserStyleSheet*> nativeStyleSheets;
+
+    static WebKitUserScript* newUserScript(const UserScriptSource& script);
+
+    void loadStyleSheets();  // Add every stylesheet, in order
+
+    std::unordered_map<String, schemecb> schemeHandlers;
+    std::unordered_map<String, uploadcb> uploadHandlers;
+
+    // Request body being read, owns its references
+    struct Upload {
+        WebKitURISchemeRequest* request;
+        GInputStream* body;
+        UploadSink sink;
+
+        ~Upload() {
+            g_object_unref(body);
+            g_object_unref(request);
+        }
+    };
+    static constexpr gsize uploadChunkSize = 64 * 1024;
+
+    void addContextScheme(const String& scheme);
+    static SchemeRequest makeSchemeRequest(WebKitURISchemeRequest* request);
+    static void readUpload(Upload* upload);
+    static void upload_read_cb(GObject* object, GAsyncResult* result,
+                               gpointer arg);
+    static void finishSchemeRequest(WebKitURISchemeRequest* request,
+                                    SchemeResponse& res);
+    static void uri_scheme_request_cb(WebKitURISchemeRequest* request,
+                                      gpointer arg);
+
+    static void external_message_received_cb(WebKitUserContentManager* m,
+                                             WebKitJavascriptResult* r,
+                                             gpointer arg);
+    static void webview_eval_finished(GObject* object, GAsyncResult* result,
+                                      gpointer arg);
+    static void webview_eval_async_finished(GObject* object,
+                                            GAsyncResult* result, gpointer arg);
+    static void finishEval(EvalRequest& req, JSCValue* value, GError* error);
+#if WEBKIT_CHECK_VERSION(2, 40, 0)
+    void runFunction(uint64_t id, const String& args, evalcb callback);
+    static void webview_call_finished(GObject* object, GAsyncResult* result,
+                                      gpointer arg);
+#endif
+    static void webview_snapshot_finished(GObject* object,
+                                          GAsyncResult* result, gpointer arg);
+    static bool drawSnapshot(cairo_surface_t* surface, Bitmap& target);
+    static void print_failed_cb(WebKitPrintOperation* op, GError* error,
+                                gpointer arg);
+    static void print_finished_cb(WebKitPrintOperation* op, gpointer arg);
+    static const std::string& filePrinter();  // Empty if there is none
+    static gboolean file_printer_cb(GtkPrinter* printer, gpointer arg);
+    static void website_data_cleared_cb(GObject* object, GAsyncResult* result,
+                                        gpointer arg);
+    static void webview_load_changed_cb(WebKitWebView* webview,
+                                        WebKitLoadEvent event, gpointer arg);
+    // Single source that drains dispatched functions
+    struct DispatchSource {
+        GSource source;
+        WebView* w;
+    };
+    GSource* dispatchSource = nullptr;
+
+    gint pollPriority = 0;  // From pollFds, for dispatchFds
+    std::vector<GPollFD> pollBuffer;
+
+    static gboolean dispatch_source_cb(GSource* source, GSourceFunc,
+                                       gpointer);
+    static void destroyWindowCb(GtkWidget* widget, gpointer arg);
+    void detachWidgets();  // Disconnect from the widgets and forget them
+    // static gboolean closeWebViewCb(WebKitWebView *webView, GtkWidget
+    // *window);
+    static gboolean webview_context_menu_cb(
+        WebKitWebView* webview, GtkWidget* default_menu,
+        WebKitHitTestResult* hit_test_result, gboolean triggered_with_keyboard,
+        gpointer userdata);
+    static gboolean webview_enter_fullscreen_cb(WebKitWebView* webview,
+                                                gpointer userdata);
+    static gboolean webview_leave_fullscreen_cb(WebKitWebView* webview,
+                                                gpointer userdata);
+#endif                       // WEBVIEW_GTK
+};
+
+#if defined(WEBVIEW_GTK)
+// Keeps hidden, initialized WebViews ready, so opening one doesn't wait for
+// init and the first page load. GTK objects can only be created on the UI
+// thread, so the pool refills while the main loop is idle.
+class WebViewPool {
+    using factory = std::function<std::unique_ptr<WebView>()>;
+
+public:
+    // create makes a WebView with everything set that's needed before init
+    // (scripts, bindings, callback, a shell page to navigate to, ...)
+    explicit WebViewPool(size_t size, factory create = nullptr);
+    ~WebViewPool();
+
+    std::unique_ptr<WebView> acquire();  // Shown, and initialized
+    size_t ready() const;                // Views waiting in the pool
+
+private:
+    size_t size;
+    factory create;
+    std::deque<std::unique_ptr<WebView>> views;
+    guint refillSource = 0;
+
+    std::unique_ptr<WebView> makeView();
+    void scheduleRefill();
+    static gboolean refill_cb(gpointer arg);
+};
+
+// Renders queued documents to PNG or PDF files over a few reusable,
+// headless WebViews. A document is rendered once it has loaded and, with
+// waitForSignal, once it has called window.renderReady().
+class BatchRenderer {
+    using donecb = std::function<void(const RenderJob&, bool)>;
+
+public:
+    explicit BatchRenderer(RenderOptions options = {});
+
+    void add(RenderJob job);  // Queue a document
+    // Render every queued document, calling done after each one
+    RenderStats run(donecb done = nullptr);
+
+private:
+    struct Slot {
+        std::unique_ptr<WebView> view;
+        RenderJob job;
+        bool busy = false;
+        bool committed = false;  // The job's page replaced the previous one
+        bool loaded = false;
+        bool signalled = false;
+        bool rendering = false;
+        uint64_t generation = 0;  // Tells callbacks of old jobs apart
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    RenderOptions options;
+    std::deque<RenderJob> queue;
+    std::vector<Slot> slots;
+    donecb done;
+    RenderStats stats;
+
+    bool start(size_t slot);  // Load the next queued job, false if no view
+    void poll(size_t slot);   // Render once the page is ready
+    void finish(size_t slot, uint64_t generation, bool ok);
+    void message(size_t slot, std::string_view msg);
+    static std::string dataUrl(const std::string& html);
+};
+#endif
+
+// Common Windows methods
+#if defined(WEBVIEW_IS_WIN)
+auto LoadLibraryPtr(LPCWSTR dll) {
+    // WIL alternative: wil::unique_hmodule(LoadLibrary(dll));
+    return std::unique_ptr<std::remove_pointer_t<HMODULE>,
+                           decltype(&::FreeLibrary)>(LoadLibrary(dll),
+                                                     FreeLibrary);
+}
+
+void setDPIAwareness() {
+    // Set default DPI awareness
+    auto user32 = LoadLibraryPtr(TEXT("User32.dll"));
+    auto pSPDAC =
+        GetProcNameAddress(user32.get(), SetProcessDpiAwarenessContext);
+    if (pSPDAC != nullptr) {
+        // Windows 10
+        pSPDAC(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2);
+        return;
+    }
+
+    auto shcore = LoadLibraryPtr(TEXT("ShCore.dll"));
+    auto pSPDA = GetProcNameAddress(shcore.get(), SetProcessDpiAwareness);
+    if (pSPDA != nullptr) {
+        // Windows 8.1
+        pSPDA(PROCESS_PER_MONITOR_DPI_AWARE);
+        return;
+    }
+
+    // Windows Vista
+    SetProcessDPIAware();  // Equivalent to DPI_AWARENESS_CONTEXT_SYSTEM_AWARE
+}
+
+UINT getDPI(HWND hwnd) {
+    auto user32 = LoadLibraryPtr(TEXT("User32.dll"));
+    auto pGDFW = GetProcNameAddress(user32.get(), GetDpiForWindow);
+    if (pGDFW != nullptr) {
+        // Windows 10
+        return pGDFW(hwnd);
+    }
+
+    auto shcore = LoadLibraryPtr(TEXT("ShCore.dll"));
+    auto pGDFM = GetProcNameAddress(shcore.get(), GetDpiForMonitor);
+    if (pGDFM != nullptr) {
+        // Windows 8.1
+        UINT newDpi;
+        HMONITOR hmonitor = MonitorFromWindow(hwnd, MONITOR_DEFAULTTONEAREST);
+        HRESULT hr = pGDFM(hmonitor, MDT_EFFECTIVE_DPI, &newDpi, nullptr);
+        if (SUCCEEDED(hr)) {
+            return newDpi;
+        }
+    }
+
+    // Windows 2000
+    if (HDC hdc = GetDC(hwnd)) {
+        auto dpi = GetDeviceCaps(hdc, LOGPIXELSX);
+        ReleaseDC(hwnd, hdc);
+        return dpi;
+    }
+
+    return USER_DEFAULT_SCREEN_DPI;
+}
+
+int WebView::WinInit() {
+    HINSTANCE hInt = GetModuleHandle(nullptr);
+    if (hInt == nullptr) {
+        return -1;
+    }
+
+    // Initialize Win32 window
+    WNDCLASSEX wc{};
+    wc.cbSize = sizeof(WNDCLASSEX);
+    wc.style = 0;
+    wc.lpfnWndProc = WndProcedure;
+    wc.cbClsExtra = 0;
+    wc.cbWndExtra = 0;
+    wc.hInstance = hInt;
+    wc.hIcon = LoadIcon(nullptr, IDI_APPLICATION);
+    wc.hCursor = LoadCursor(nullptr, IDC_ARROW);
+    wc.hbrBackground = (HBRUSH)(COLOR_WINDOW + 1);
+    wc.lpszMenuName = nullptr;
+    wc.lpszClassName = L"webview";
+    wc.hIconSm = LoadIcon(nullptr, IDI_APPLICATION);
+
+    if (!RegisterClassEx(&wc)) {
+        MessageBox(nullptr, L"Call to RegisterClassEx failed!", L"Error!",
+                   NULL);
+
+        return -1;
+    }
+
+    // Set default DPI awareness
+    setDPIAwareness();
+
+    hwnd = CreateWindow(L"webview", title.c_str(), WS_OVERLAPPEDWINDOW,
+                        CW_USEDEFAULT, CW_USEDEFAULT, width, height, nullptr,
+                        nullptr, hInt, nullptr);
+
+    if (hwnd == nullptr) {
+        MessageBox(nullptr, L"Window Registration Failed!", L"Error!",
+                   MB_ICONEXCLAMATION | MB_OK);
+        return -1;
+    }
+
+    // Scale window based on DPI
+    dpi = getDPI(hwnd);
+
+    RECT rect = {};
+    GetWindowRect(hwnd, &rect);
+    SetWindowPos(hwnd, nullptr, rect.left, rect.top,
+                 MulDiv(width, dpi, USER_DEFAULT_SCREEN_DPI),
+                 MulDiv(height, dpi, USER_DEFAULT_SCREEN_DPI),
+                 SWP_NOZORDER | SWP_NOACTIVATE | SWP_FRAMECHANGED);
+
+    if (!resizable) {
+        auto style = GetWindowLongPtr(hwnd, GWL_STYLE);
+        style &= ~(WS_THICKFRAME | WS_MAXIMIZEBOX);
+        SetWindowLongPtr(hwnd, GWL_STYLE, style);
+    }
+
+    // Used with GetWindowLongPtr in WndProcedure
+    SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)this);
+
+    // Run anything dispatched before the window existed
+    if (wakePending) {
+        wakeUp();
+    }
+
+    if (visible) {
+        ShowWindow(hwnd, SW_SHOWDEFAULT);
+        UpdateWindow(hwnd);
+        SetFocus(hwnd);
+    }
+
+    return 0;
+}
+
+void WebView::setTitle(std::wstring t) {
+    if (!init_done) {
+        title = t;
+    } else {
+        SetWindowText(hwnd, t.c_str());
+    }
+}
+
+// Adapted from
+// https://source.chromium.org/chromium/chromium/src/+/main:ui/views/win/fullscreen_handler.cc
+void WebView::setFullscreen(bool fs) {
+    if (isFullscreen == fs) return;
+
+    isFullscreen = fs;
+
+    if (fs) {
+        // Store window style before going fullscreen
+        savedWindowInfo.style = GetWindowLongPtr(hwnd, GWL_STYLE);
+        savedWindowInfo.exstyle = GetWindowLongPtr(hwnd, GWL_EXSTYLE);
+        GetWindowRect(hwnd, &savedWindowInfo.rect);
+
+        // Set new window style
+        SetWindowLongPtr(hwnd, GWL_STYLE,
+                         savedWindowInfo.style & ~(WS_CAPTION | WS_THICKFRAME));
+        SetWindowLongPtr(
+            hwnd, GWL_EXSTYLE,
+            savedWindowInfo.exstyle & ~(WS_EX_DLGMODALFRAME | WS_EX_WINDOWEDGE |
+                                        WS_EX_CLIENTEDGE | WS_EX_STATICEDGE));
+
+        // Get monitor size
+        MONITORINFO monitorInfo;
+        monitorInfo.cbSize = sizeof(monitorInfo);
+        GetMonitorInfo(MonitorFromWindow(hwnd, MONITOR_DEFAULTTONEAREST),
+                       &monitorInfo);
+
+        // Set window size to monitor size
+        SetWindowPos(hwnd, nullptr, monitorInfo.rcMonitor.left,
+                     monitorInfo.rcMonitor.top,
+                     monitorInfo.rcMonitor.right - monitorInfo.rcMonitor.left,
+                     monitorInfo.rcMonitor.bottom - monitorInfo.rcMonitor.top,
+                     SWP_NOZORDER | SWP_NOACTIVATE | SWP_FRAMECHANGED);
+    } else {
+        // Restore window style
+        SetWindowLongPtr(hwnd, GWL_STYLE, savedWindowInfo.style);
+        SetWindowLongPtr(hwnd, GWL_EXSTYLE, savedWindowInfo.exstyle);
+
+        // Restore window size
+        SetWindowPos(hwnd, nullptr, savedWindowInfo.rect.left,
+                     savedWindowInfo.rect.top,
+                     savedWindowInfo.rect.right - savedWindowInfo.rect.left,
+                     savedWindowInfo.rect.bottom - savedWindowInfo.rect.top,
+                     SWP_NOZORDER | SWP_NOACTIVATE | SWP_FRAMECHANGED);
+    }
+}
+
+void WebView::setVisible(bool v) {
+    visible = v;
+    if (hwnd == nullptr) {
+        return;  // Shown by WinInit
+    }
+    ShowWindow(hwnd, v ? SW_SHOW : SW_HIDE);
+    if (v) {
+        SetFocus(hwnd);
+    }
+}
+
+bool WebView::run() {
+    flushEvals();
+    bool loop = GetMessage(&msg, nullptr, 0, 0) > 0;
+    if (loop) {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+    return !loop;
+}
+
+bool WebView::runFor(std::chrono::milliseconds timeout) {
+    flushEvals();
+    auto ms = std::clamp<std::chrono::milliseconds::rep>(timeout.count(), 0,
+                                                        INFINITE - 1);
+    MsgWaitForMultipleObjectsEx(0, nullptr, static_cast<DWORD>(ms),
+                                QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+
+    // Handle everything that arrived, without waiting for more
+    while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
+        if (msg.message == WM_QUIT) {
+            return true;
+        }
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+    return false;
+}
+
+void WebView::wakeUp() {
+    // Before the window exists, WinInit() wakes up instead
+    if (hwnd != nullptr) {
+        PostMessage(hwnd, WM_APP, 0, 0);
+    }
+}
+
+LRESULT CALLBACK WebView::WndProcedure(HWND hwnd, UINT msg, WPARAM wparam,
+                                       LPARAM lparam) {
+    WebView* w =
+        reinterpret_cast<WebView*>(GetWindowLongPtr(hwnd, GWLP_USERDATA));
+
+    switch (msg) {
+        case WM_SIZE:
+            // WM_SIZE will first fire before the webview finishes loading
+            // init() calls resize(), so this call is only for size changes
+            // after fully loading.
+            if (w != nullptr && w->init_done) {
+                w->resize();
+            }
+            return DefWindowProc(hwnd, msg, wparam, lparam);
+        case WM_DPICHANGED:
+            if (w != nullptr) {
+                // Resize on DPI change
+                UINT dpi = HIWORD(wparam);
+                const auto& rect = *reinterpret_cast<RECT*>(lparam);
+                w->onDPIChange(dpi, rect);
+            }
+            break;
+        case WM_DESTROY:
+            w->exit();
+            break;
+        case WM_APP:
+            // Posted by wakeUp()
+            w->runDispatched();
+            break;
+        default:
+            return DefWindowProc(hwnd, msg, wparam, lparam);
+    }
+    return 0;
+}
+
+void WebView::onDPIChange(const UINT newDpi, const RECT& rect) {
+    auto oldDpi = std::exchange(dpi, newDpi);
+
+    if (isFullscreen) {
+        // Scale the saved window size by the change in DPI
+        auto oldWidth = savedWindowInfo.rect.right - savedWindowInfo.rect.left;
+        auto oldHeight = savedWindowInfo.rect.bottom - savedWindowInfo.rect.top;
+        savedWindowInfo.rect.right =
+            savedWindowInfo.rect.left + MulDiv(oldWidth, newDpi, oldDpi);
+        savedWindowInfo.rect.bottom =
+            savedWindowInfo.rect.top + MulDiv(oldHeight, newDpi, oldDpi);
+    } else {
+        SetWindowPos(hwnd, nullptr, rect.left, rect.top, rect.right - rect.left,
+                     rect.bottom - rect.top,
+                     SWP_NOZORDER | SWP_NOACTIVATE | SWP_FRAMECHANGED);
+    }
+}
+#endif
+
+#if defined(WEBVIEW_WIN)
+// Await helper
+template <typename T>
+auto block(T const& async) {
+    if (async.Status() != AsyncStatus::Completed) {
+        winrt::handle h(CreateEvent(nullptr, false, false, nullptr));
+        async.Completed([h = h.get()](auto, auto) { SetEvent(h); });
+        HANDLE hs[] = {h.get()};
+        DWORD i;
+        CoWaitForMultipleHandles(COWAIT_DISPATCH_WINDOW_MESSAGES |
+                                     COWAIT_DISPATCH_CALLS |
+                                     COWAIT_INPUTAVAILABLE,
+                                 INFINITE, 1, hs, &i);
+    }
+    return async.GetResults();
+}
+
+int WebView::init() {
+    if (auto res = WinInit(); res) {
+        return res;
+    }
+
+    // Set to single-thread
+    init_apartment(winrt::apartment_type::single_threaded);
+
+    // Allow intranet access (and localhost)
+    WebViewControlProcessOptions options;
+    options.PrivateNetworkClientServerCapability(
+        WebViewControlProcessCapabilityState::Enabled);
+
+    WebViewControlProcess proc(options);
+    webview = block(proc.CreateWebViewControlAsync(
+        reinterpret_cast<int64_t>(hwnd), Rect()));
+    webview.Settings().IsScriptNotifyAllowed(true);
+    webview.ScriptNotify([this](const auto&, const auto& args) {
+        winrt::hstring value = args.Value();
+        onMessage(value);
+    });
+    webview.NavigationStarting([this](const auto&, const auto&) {
+        webview.AddInitializeScript(injectScript());
+        webview.AddInitializeScript(evalHelper);
+    });
+
+    // Detect fullscreen request from JS
+    webview.ContainsFullScreenElementChanged([this](const auto&, const auto&) {
+        if (fullscreenFromJS) {
+            this->setFullscreen(webview.ContainsFullScreenElement());
+        }
+    });
+
+    // Set webview bounds
+    resize();
+
+    webview.IsVisible(true);
+
+    // Done initialization, set properties
+    init_done = true;
+
+    setTitle(title);
+    if (fullscreen) {
+        setFullscreen(true);
+    }
+    setBgColor(bgR, bgG, bgB, bgA);
+    navigate(url);
+
+    return 0;
+}
+
+void WebView::setFullscreenFromJS(bool allow) { fullscreenFromJS = allow; }
+
+void WebView::setBgColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+    if (!init_done) {
+        bgR = r;
+        bgG = g;
+        bgB = b;
+        bgA = a;
+    } else {
+        webview.DefaultBackgroundColor({a, r, g, b});
+    }
+}
+
+void WebView::navigate(std::wstring u) {
+    if (!init_done) {
+        url = u;
+    } else if (constexpr auto prefix = L"data:text/html,";
+               u.rfind(prefix, 0) == 0) {
+        constexpr auto len = std::wstring_view(prefix).size();
+        webview.NavigateToString(u.substr(len));
+    } else {
+        Uri uri{u};
+        webview.Navigate(uri);
+    }
+}
+
+void WebView::eval(const std::wstring& js) {
+    flushEvals();
+    auto result = block(webview.InvokeScriptAsync(
+        L"eval", std::vector<winrt::hstring>({winrt::hstring(js)})));
+
+    // if (debug) {
+    // std::cout << winrt::to_string(result) << std::endl;
+    //}
+}
+
+void WebView::runScript(const std::wstring& js, evalcb callback) {
+    auto async = webview.InvokeScriptAsync(
+        L"__webview_eval", std::vector<winrt::hstring>({winrt::hstring(js)}));
+    async.Completed([this, callback](const auto& op, AsyncStatus status) {
+        if (!callback) {
+            return;
+        }
+
+        if (status == AsyncStatus::Completed) {
+            std::wstring result{op.GetResults()};
+            callback(*this, true, result);
+        } else {
+            std::wstring error =
+                L"Script failed with HRESULT " +
+                std::to_wstring(static_cast<int32_t>(op.ErrorCode()));
+            callback(*this, false, error);
+        }
+    });
+}
+
+void WebView::addInjectScript() {
+    // Nothing to do, it's added again on every navigation
+}
+
+void WebView::exit() { PostQuitMessage(WM_QUIT); }
+
+void WebView::resize() {
+    RECT rc;
+    GetClientRect(hwnd, &rc);
+    Rect bounds((float)rc.left, (float)rc.top, (float)(rc.right - rc.left),
+                (float)(rc.bottom - rc.top));
+    webview.Bounds(bounds);
+}
+#elif defined(WEBVIEW_EDGE)  // WEBVIEW_WIN
+int WebView::init() {
+    if (auto res = WinInit(); res) {
+        return res;
+    }
+
+    // Set to single-thread
+    auto inithr = CoInitializeEx(
+        nullptr, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+    if (FAILED(inithr)) {
+        return -1;
+    }
+
+    auto onWebMessageReceieved =
+        [this](ICoreWebView2*, ICoreWebView2WebMessageReceivedEventArgs* args) {
+            // Consider args->get_WebMessageAsJson?
+            LPWSTR messageRaw;
+            auto getMessageResult =
+                args->TryGetWebMessageAsString(&messageRaw);
+            if (FAILED(getMessageResult)) {
+                return getMessageResult;
+            }
+
+            onMessage(messageRaw);
+            CoTaskMemFree(messageRaw);
+            return S_OK;
+        };
+
+    auto onWebViewControllerCreate =
+        [this, onWebMessageReceieved](
+            HRESULT result, ICoreWebView2Controller* controller) -> HRESULT {
+        if (FAILED(result)) {
+            return result;
+        }
+
+        if (controller != nullptr) {
+            webviewController = controller;
+            webviewController->get_CoreWebView2(&webviewWindow);
+        }
+
+        wil::com_ptr<ICoreWebView2Settings> settings;
+        webviewWindow->get_Settings(&settings);
+        if (!debug) {
+            settings->put_AreDevToolsEnabled(FALSE);
+        }
+
+        // Resize WebView
+        resize();
+
+        addInjectScript();
+
+        webviewWindow->add_WebMessageReceived(
+            Callback<ICoreWebView2WebMessageReceivedEventHandler>(
+                onWebMessageReceieved)
+                .Get(),
+            nullptr);
+
+        // Detect fullscreen change from JS
+        webviewWindow->add_ContainsFullScreenElementChanged(
+            Callback<ICoreWebView2ContainsFullScreenElementChangedEventHandler>(
+                [this](ICoreWebView2*, IUnknown*) {
+                    if (fullscreenFromJS) {
+                        BOOL containsFs = false;
+                        webviewWindow->get_ContainsFullScreenElement(
+                            &containsFs);
+                        this->setFullscreen(containsFs);
+                    }
+
+                    return S_OK;
+                })
+                .Get(),
+            nullptr);
+
+        // Done initialization, set properties
+        init_done = true;
+
+        setTitle(title);
+        if (fullscreen) {
+            setFullscreen(true);
+        }
+        setBgColor(bgR, bgG, bgB, bgA);
+        navigate(url);
+
+        return S_OK;
+    };
+
+    auto onCreateEnvironment = [this, onWebViewControllerCreate](
+                                   HRESULT result,
+                                   ICoreWebView2Environment* env) -> HRESULT {
+        if (result == HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND)) {
+            MessageBox(nullptr, L"Could not find Edge installation.", L"Error!",
+                       NULL);
+            return result;
+        }
+
+        // Create Webview2 controller
+        return env->CreateCoreWebView2Controller(
+            hwnd,
+            Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
+                onWebViewControllerCreate)
+                .Get());
+    };
+
+    // Get APPDATA path
+    PCWSTR userDataFolderPtr = nullptr;
+    std::wstring userDataFolder;
+
+    DWORD bufferLength = 32767;
+    std::wstring appdataPath;
+    appdataPath.resize(bufferLength);
+    bufferLength = GetEnvironmentVariable(Str("APPDATA"), appdataPath.data(),
+                                          bufferLength);
+    if (bufferLength) {
+        appdataPath.resize(bufferLength);
+
+        // Get executable file name
+        wchar_t exePath[MAX_PATH];
+        GetModuleFileName(NULL, exePath, MAX_PATH);
+        userDataFolder = (appdataPath + Str("/") + PathFindFileName(exePath));
+        userDataFolderPtr = userDataFolder.c_str();
+    }
+
+    // Create WebView2 environment
+    auto hr = CreateCoreWebView2EnvironmentWithOptions(
+        nullptr, userDataFolderPtr, nullptr,
+        Callback<ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler>(
+            onCreateEnvironment)
+            .Get());
+
+    if (FAILED(hr)) {
+        CoUninitialize();
+        return -1;
+    }
+
+    return 0;
+}
+
+void WebView::setFullscreenFromJS(bool allow) { fullscreenFromJS = allow; }
+
+void WebView::setBgColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+    if (!init_done) {
+        bgR = r;
+        bgG = g;
+        bgB = b;
+        bgA = a;
+    } else {
+        // TODO
+    }
+}
+
+void WebView::navigate(std::wstring u) {
+    if (!init_done) {
+        url = u;
+    } else {
+        webviewWindow->Navigate(u.c_str());
+    }
+}
+
+void WebView::eval(const std::wstring& js) {
+    flushEvals();
+
+    // Schedule an async task to get the document URL
+    webviewWindow->ExecuteScript(
+        js.c_str(), Callback<ICoreWebView2ExecuteScriptCompletedHandler>(
+                        [](HRESULT, LPCWSTR) -> HRESULT {
+                            // LPCWSTR URL = resultObjectAsJson;
+                            // doSomethingWithURL(URL);
+                            return S_OK;
+                        })
+                        .Get());
+
+    // if (debug) {
+    // std::cout << winrt::to_string(result) << std::endl;
+    //}
+}
+
+void WebView::runScript(const std::wstring& js, evalcb callback) {
+    webviewWindow->ExecuteScript(
+        js.c_str(),
+        Callback<ICoreWebView2ExecuteScriptCompletedHandler>(
+            [this, callback](HRESULT hr, LPCWSTR resultJson) -> HRESULT {
+                if (!callback) {
+                    return S_OK;
+                }
+
+                if (SUCCEEDED(hr)) {
+                    std::wstring result(resultJson);
+                    callback(*this, true, result);
+                } else {
+                    std::wstring error = L"Script failed with HRESULT " +
+                                         std::to_wstring(hr);
+                    callback(*this, false, error);
+                }
+                return S_OK;
+            })
+            .Get());
+}
+
+void WebView::addInjectScript() {
+    if (!injectScriptId.empty()) {
+        webviewWindow->RemoveScriptToExecuteOnDocumentCreated(
+            injectScriptId.c_str());
+        injectScriptId.clear();
+    }
+
+    // Adding is async, so a script replaced before it got its id removes
+    // itself once it does
+    uint64_t version = ++injectScriptVersion;
+    webviewWindow->AddScriptToExecuteOnDocumentCreated(
+        injectScript().c_str(),
+        Callback<
+            ICoreWebView2AddScriptToExecuteOnDocumentCreatedCompletedHandler>(
+            [this, version](HRESULT hr, LPCWSTR id) -> HRESULT {
+                if (FAILED(hr)) {
+                    return S_OK;
+                }
+
+                if (version == injectScriptVersion) {
+                    injectScriptId = id;
+                } else {
+                    webviewWindow->RemoveScriptToExecuteOnDocumentCreated(id);
+                }
+                return S_OK;
+            })
+            .Get());
+}
+
+void WebView::exit() {
+    PostQuitMessage(WM_QUIT);
+    CoUninitialize();
+}
+
+void WebView::resize() {
+    RECT rc;
+    GetClientRect(hwnd, &rc);
+    webviewController->put_Bounds(rc);
+}
+#elif defined(WEBVIEW_MAC)   // WEBVIEW_EDGE
+int WebView::init() {
+    // Initialize autorelease pool
+    pool = [NSAutoreleasePool new];
+
+    // Window style: titled, closable, minimizable
+    uint style = NSWindowStyleMaskTitled | NSWindowStyleMaskClosable |
+                 NSWindowStyleMaskMiniaturizable;
+
+    // Set window to be resizable
+    if (resizable) {
+        style |= NSWindowStyleMaskResizable;
+    }
+
+    // Initialize Cocoa window
+    window = [[NSWindow alloc]
+        // Initial window size
+        initWithContentRect:NSMakeRect(0, 0, width, height)
+                  // Window style
+                  styleMask:style
+                    backing:NSBackingStoreBuffered
+                      defer:NO];
+
+    // Minimum window size
+    [window setContentMinSize:NSMakeSize(width, height)];
+
+    // Position window in center of screen
+    [window center];
+
+    // Initialize WKWebView
+    WKWebViewConfiguration* config = [WKWebViewConfiguration new];
+    WKPreferences* prefs = [config preferences];
+    [prefs setJavaScriptCanOpenWindowsAutomatically:NO];
+    if (debug) {
+        [prefs setValue:@YES forKey:@"developerExtrasEnabled"];
+    }
+
+    // Allow fullscreen control from JS
+    if (fullscreenFromJS) {
+        [prefs setValue:@YES forKey:@"fullScreenEnabled"];
+    }
+
+    WKUserContentController* controller = [config userContentController];
+    webview = [[WKWebView alloc] initWithFrame:NSZeroRect configuration:config];
+    addInjectScript();
+
+    // Add delegate methods manually in order to capture "this"
+    class_replaceMethod(
+        [WindowDelegate class], @selector(windowWillClose:),
+        imp_implementationWithBlock([=](id, SEL, id) { this->exit(); }),
+        "v@:@");
+
+    class_replaceMethod(
+        [WindowDelegate class],
+        @selector(userContentController:didReceiveScriptMessage:),
+        imp_implementationWithBlock(
+            [=](id, SEL, WKScriptMessage* scriptMessage) {
+                id body = [scriptMessage body];
+                if (![body isKindOfClass:[NSString class]]) {
+                    return;
+                }
+
+                // Owned by the autorelease pool, so no copy is needed
+                this->onMessage([body UTF8String]);
+            }),
+        "v@:@");
+
+    WindowDelegate* delegate = [WindowDelegate alloc];
+    [controller addScriptMessageHandler:delegate name:@"webview"];
+    // Set delegate to window
+    [window setDelegate:delegate];
+
+    // Initialize application
+    [NSApplication sharedApplication];
+    [NSApp setActivationPolicy:NSApplicationActivationPolicyRegular];
+
+    // Sets the app as the active app
+    [NSApp activateIgnoringOtherApps:YES];
+
+    // Add webview to window
+    [window setContentView:webview];
+
+    // Display window
+    if (visible) {
+        [window makeKeyAndOrderFront:nil];
+    }
+
+    // Done initialization, set properties
+    init_done = true;
+
+    setTitle(title);
+    if (fullscreen) {
+        setFullscreen(true);
+    }
+    setBgColor(bgR, bgG, bgB, bgA);
+    navigate(url);
+
+    return 0;
+}
+
+void WebView::setTitle(std::string t) {
+    if (!init_done) {
+        title = t;
+    } else {
+        [window setTitle:[NSString stringWithUTF8String:t.c_str()]];
+    }
+}
+
+void WebView::setFullscreen(bool fs) {
+    if (!init_done) {
+        fullscreen = fs;
+    } else {
+        // TODO: replace toggle with set
+        [window toggleFullScreen:nil];
+    }
+}
+
+void WebView::setVisible(bool v) {
+    visible = v;
+    if (!init_done) {
+        return;
+    }
+    if (v) {
+        [window makeKeyAndOrderFront:nil];
+    } else {
+        [window orderOut:nil];
+    }
+}
+
+void WebView::setFullscreenFromJS(bool allow) { fullscreenFromJS = allow; }
+
+void WebView::setBgColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+    if (!init_done) {
+        bgR = r;
+        bgG = g;
+        bgB = b;
+        bgA = a;
+    } else {
+        [window setBackgroundColor:[NSColor colorWithCalibratedRed:r / 255.0
+                                                             green:g / 255.0
+                                                              blue:b / 255.0
+                                                             alpha:a / 255.0]];
+    }
+}
+
+bool WebView::run() {
+    flushEvals();
+    NSEvent* event = [NSApp nextEventMatchingMask:NSEventMaskAny
+                                        untilDate:[NSDate distantFuture]
+                                           inMode:NSDefaultRunLoopMode
+                                          dequeue:true];
+    if (event) {
+        [NSApp sendEvent:event];
+    }
+
+    return should_exit;
+}
+
+bool WebView::runFor(std::chrono::milliseconds timeout) {
+    flushEvals();
+    double seconds =
+        std::max(0.0, static_cast<double>(timeout.count()) / 1000.0);
+    NSEvent* event = [NSApp
+        nextEventMatchingMask:NSEventMaskAny
+                    untilDate:[NSDate dateWithTimeIntervalSinceNow:seconds]
+                       inMode:NSDefaultRunLoopMode
+                      dequeue:true];
+    if (event) {
+        [NSApp sendEvent:event];
+    }
+
+    return should_exit;
+}
+
+void WebView::navigate(std::string u) {
+    if (!init_done) {
+        url = u;
+    } else if (u.rfind("data:", 0) == 0) {
+        [webview loadHTMLString:[NSString stringWithUTF8String:u.c_str()]
+                        baseURL:nil];
+    } else {
+        [webview
+            loadRequest:[NSURLRequest
+                            requestWithURL:
+                                [NSURL URLWithString:[NSString
+                                                         stringWithUTF8String:
+                                                             u.c_str()]]]];
+    }
+}
+
+void WebView::eval(const std::string& js) {
+    flushEvals();
+    [webview evaluateJavaScript:[NSString stringWithUTF8String:js.c_str()]
+              completionHandler:nil];
+}
+
+void WebView::runScript(const std::string& js, evalcb callback) {
+    [webview evaluateJavaScript:[NSString stringWithUTF8String:js.c_str()]
+              completionHandler:^(id result, NSError* error) {
+                if (!callback) {
+                    return;
+                }
+
+                if (error != nil) {
+                    std::string msg = [[error localizedDescription] UTF8String];
+                    callback(*this, false, msg);
+                    return;
+                }
+
+                // WebKit gives back Foundation objects, convert them to JSON
+                std::string json = "null";
+                if (result != nil) {
+                    NSData* data = [NSJSONSerialization
+                        dataWithJSONObject:result
+                                   options:NSJSONWritingFragmentsAllowed
+                                     error:nil];
+                    if (data != nil) {
+                        json.assign(static_cast<const char*>([data bytes]),
+                                    [data length]);
+                    }
+                }
+                callback(*this, true, json);
+              }];
+}
+
+void WebView::addInjectScript() {
+    // It's the only script the controller has
+    WKUserContentController* controller =
+        [[webview configuration] userContentController];
+    [controller removeAllUserScripts];
+
+    WKUserScript* userScript = [WKUserScript alloc];
+    std::string source = injectScript();
+    [userScript initWithSource:[NSString stringWithUTF8String:source.c_str()]
+                 injectionTime:WKUserScriptInjectionTimeAtDocumentStart
+              forMainFrameOnly:NO];
+    [controller addUserScript:userScript];
+}
+
+void WebView::exit() {
+    // Distinguish window closing with app exiting
+    should_exit = true;
+    [NSApp terminate:nil];
+}
+
+void WebView::wakeUp() {
+    dispatch_async(dispatch_get_main_queue(), ^{
+      this->runDispatched();
+    });
+}
+
+#elif defined(WEBVIEW_GTK)  // WEBVIEW_MAC
+int WebView::init() {
+    markPhase(metrics.initStart);
+    if (gtk_init_check(0, NULL) == FALSE) {
+        return -1;
+    }
+    markPhase(metrics.gtkInit);
+
+    // Dispatched functions are run by one source on the default context,
+    // which is armed with a ready time instead of adding an idle per call
+    static GSourceFuncs dispatchFuncs{};
+    dispatchFuncs.dispatch = dispatch_source_cb;
+    GSource* source = g_source_new(&dispatchFuncs, sizeof(DispatchSource));
+    reinterpret_cast<DispatchSource*>(source)->w = this;
+    g_source_attach(source, nullptr);
+    dispatchSource = source;
+    if (wakePending) {
+        wakeUp();
+    }
+
+    // Initialize GTK window. A headless one is drawn offscreen, so it needs
+    // no window manager, and it is sized by its size request.
+    if (headless) {
+        window = gtk_offscreen_window_new();
+        gtk_widget_set_size_request(window, width, height);
+    } else {
+        window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+        if (resizable) {
+            gtk_window_set_default_size(GTK_WINDOW(window), width, height);
+        } else {
+            gtk_widget_set_size_request(window, width, height);
+        }
+
+        gtk_window_set_resizable(GTK_WINDOW(window), resizable);
+        gtk_window_set_position(GTK_WINDOW(window), GTK_WIN_POS_CENTER);
+    }
+
+    // Add scrolling container
+    GtkWidget* scroller = gtk_scrolled_window_new(nullptr, nullptr);
+    gtk_container_add(GTK_CONTAINER(window), scroller);
+    markPhase(metrics.windowCreated);
+
+    // Content manager
+    WebKitUserContentManager* cm = webkit_user_content_manager_new();
+    webkit_user_content_manager_register_script_message_handler(cm, "external");
+    g_signal_connect(cm, "script-message-received::external",
+                     G_CALLBACK(external_message_received_cb), this);
+    markPhase(metrics.contentManager);
+
+    // WebView, in the context every WebView shares. A related view also
+    // shares its web process.
+    webview = GTK_WIDGET(g_object_new(
+        WEBKIT_TYPE_WEB_VIEW, "web-context", webContext(),
+        "user-content-manager", cm, "related-view",
+        relatedView != nullptr ? relatedView->webview : nullptr, nullptr));
+    g_signal_connect(G_OBJECT(webview), "load-changed",
+                     G_CALLBACK(webview_load_changed_cb), this);
+
+    // Custom URI schemes are routed back to this instance
+    g_object_set_data(G_OBJECT(webview), "wv-webview", this);
+    for (const auto& [scheme, handler] : schemeHandlers) {
+        addContextScheme(scheme);
+    }
+    for (const auto& [scheme, handler] : uploadHandlers) {
+        addContextScheme(scheme);
+    }
+    gtk_container_add(GTK_CONTAINER(scroller), webview);
+
+    g_signal_connect(window, "destroy", G_CALLBACK(destroyWindowCb), this);
+    // g_signal_connect(webview, "close", G_CALLBACK(closeWebViewCb), window);
+
+    // Dev Tools if debug
+    if (debug) {
+        WebKitSettings* settings =
+            webkit_web_view_get_settings(WEBKIT_WEB_VIEW(webview));
+        webkit_settings_set_enable_write_console_messages_to_stdout(settings,
+                                                                    true);
+        webkit_settings_set_enable_developer_extras(settings, true);
+    } else {
+        g_signal_connect(G_OBJECT(webview), "context-menu",
+                         G_CALLBACK(webview_context_menu_cb), nullptr);
+    }
+
+    webkit_user_content_manager_add_script(
+        cm, webkit_user_script_new(
+                inject.c_str(), WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+                WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START, NULL, NULL));
+    for (const auto& [id, script] : userScripts) {
+        nativeUserScripts[id] = newUserScript(script);
+        webkit_user_content_manager_add_script(cm, nativeUserScripts[id]);
+    }
+    loadStyleSheets();
+    markPhase(metrics.webViewCreated);
+
+    // Monitor for fullscreen changes
+    g_signal_connect(G_OBJECT(webview), "enter-fullscreen",
+                     G_CALLBACK(webview_enter_fullscreen_cb), this);
+    g_signal_connect(G_OBJECT(webview), "leave-fullscreen",
+                     G_CALLBACK(webview_leave_fullscreen_cb), this);
+
+    // Done initialization, set properties
+    init_done = true;
+
+    setTitle(title);
+    if (fullscreen) {
+        setFullscreen(true);
+    }
+    setBgColor(bgR, bgG, bgB, bgA);
+    navigate(url);
+
+    // Finish. A hidden window still loads its page, and a headless one is
+    // shown so it renders, but never reaches the screen.
+    gtk_widget_grab_focus(GTK_WIDGET(webview));
+    gtk_widget_show_all(visible || headless ? window : scroller);
+
+    return 0;
+}
+
+WebView::~WebView() {
+    // Nothing may dispatch to this WebView anymore
+    workers.reset();
+    if (dispatchSource != nullptr) {
+        g_source_destroy(dispatchSource);
+        g_source_unref(dispatchSource);
+        dispatchSource = nullptr;
+    }
+    g_cancellable_cancel(cancellable);
+    g_object_unref(cancellable);
+
+    // A window the user closed is already gone
+    if (window != nullptr) {
+        GtkWidget* toplevel = window;
+        detachWidgets();
+        gtk_widget_destroy(toplevel);
+    }
+
+    for (const auto& [id, script] : nativeUserScripts) {
+        webkit_user_script_unref(script);
+    }
+    for (const auto& [id, sheet] : nativeStyleSheets) {
+        webkit_user_style_sheet_unref(sheet);
+    }
+    // Print operations finish on their own, without calling back
+    for (PrintRequest* req : prints) {
+        req->w = nullptr;
+    }
+}
+
+void WebView::setTitle(std::string t) {
+    if (!init_done) {
+        title = t;
+    } else {
+        gtk_window_set_title(GTK_WINDOW(window), t.c_str());
+    }
+}
+
+void WebView::setFullscreen(bool fs) {
+    if (!init_done) {
+        fullscreen = fs;
+    } else if (headless) {
+        return;  // No screen to fill
+    } else if (fs) {
+        gtk_window_fullscreen(GTK_WINDOW(window));
+    } else {
+        gtk_window_unfullscreen(GTK_WINDOW(window));
+    }
+}
+
+void WebView::setVisible(bool v) {
+    visible = v;
+    if (!init_done || headless) {
+        return;
+    }
+    if (v) {
+        gtk_widget_show_all(window);
+        gtk_window_present(GTK_WINDOW(window));
+    } else {
+        gtk_widget_hide(window);
+    }
+}
+
+void WebView::setFullscreenFromJS(bool allow) { fullscreenFromJS = allow; }
+
+void WebView::setBgColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+    if (!init_done) {
+        bgR = r;
+        bgG = g;
+        bgB = b;
+        bgA = a;
+    } else {
+        GdkRGBA color = {r / 255.0, g / 255.0, b / 255.0, a / 255.0};
+        webkit_web_view_set_background_color(WEBKIT_WEB_VIEW(webview), &color);
+    }
+}
+
+bool WebView::run() {
+    flushEvals();
+    gtk_main_iteration_do(true);
+    return should_exit;
+}
+
+bool WebView::runFor(std::chrono::milliseconds timeout) {
+    // One iteration of the GLib loop, but with our own bound on the wait
+    int wait = pollFds(pollBuffer);
+    auto limit = std::clamp<std::chrono::milliseconds::rep>(
+        timeout.count(), 0, std::numeric_limits<int>::max());
+    if (wait < 0 || wait > limit) {
+        wait = static_cast<int>(limit);
+    }
+    g_poll(pollBuffer.data(), static_cast<guint>(pollBuffer.size()), wait);
+    return dispatchFds(pollBuffer);
+}
+
+int WebView::pollFds(std::vector<GPollFD>& fds) {
+    flushEvals();
+    GMainContext* context = g_main_context_default();
+    g_main_context_acquire(context);  // Released by dispatchFds
+    g_main_context_prepare(context, &pollPriority);
+
+    // Grow the buffer until every fd fits
+    gint timeout = -1;
+    fds.resize(std::max<size_t>(fds.capacity(), 16));
+    gint n;
+    while ((n = g_main_context_query(context, pollPriority, &timeout,
+                                     fds.data(),
+                                     static_cast<gint>(fds.size()))) >
+           static_cast<gint>(fds.size())) {
+        fds.resize(static_cast<size_t>(n));
+    }
+    fds.resize(static_cast<size_t>(n));
+    return timeout;
+}
+
+bool WebView::dispatchFds(std::vector<GPollFD>& fds) {
+    GMainContext* context = g_main_context_default();
+    if (g_main_context_check(context, pollPriority, fds.data(),
+                             static_cast<gint>(fds.size()))) {
+        g_main_context_dispatch(context);
+    }
+    g_main_context_release(context);
+    return should_exit;
+}
+
+void WebView::navigate(std::string u) {
+    if (!init_done) {
+        url = u;
+    } else {
+        markPhase(metrics.navigate);
+        webkit_web_view_load_uri(WEBKIT_WEB_VIEW(webview), u.c_str());
+    }
+}
+
+void WebView::eval(const std::string& js) {
+    flushEvals();
+    while (!ready) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    js_busy = true;
+    webkit_web_view_run_javascript(WEBKIT_WEB_VIEW(webview), js.c_str(), NULL,
+                                   webview_eval_finished, this);
+    while (js_busy) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+}
+
+void WebView::runScript(const std::string& js, evalcb callback) {
+    if (!ready) {
+        // Sent once the page finishes loading
+        pendingEvals.emplace_back(js, std::move(callback));
+        return;
+    }
+
+    webkit_web_view_run_javascript(WEBKIT_WEB_VIEW(webview), js.c_str(),
+                                   cancellable, webview_eval_async_finished,
+                                   new EvalRequest{this, std::move(callback)});
+}
+
+void WebView::exit() { should_exit = true; }
+
+void WebView::wakeUp() {
+    // Thread-safe, and wakes up the main context if it's blocked. Before
+    // the source exists, init() wakes up instead.
+    if (dispatchSource != nullptr) {
+        g_source_set_ready_time(dispatchSource, 0);
+    }
+}
+
+void WebView::shareWebProcess(WebView& other) {
+    // The other view has to exist by the time this one is created
+    if (!init_done && other.init_done) {
+        relatedView = &other;
+    }
+}
+
+void WebView::setHeadless(bool h) {
+    if (!init_done) {
+        headless = h;
+    }
+}
+
+WebViewPool::WebViewPool(size_t size_, factory create_)
+    : size(size_), create(std::move(create_)) {
+    scheduleRefill();
+}
+
+WebViewPool::~WebViewPool() {
+    if (refillSource != 0) {
+        g_source_remove(refillSource);
+    }
+}
+
+std::unique_ptr<WebView> WebViewPool::acquire() {
+    std::unique_ptr<WebView> w;
+    if (views.empty()) {
+        w = makeView();
+    } else {
+        w = std::move(views.front());
+        views.pop_front();
+    }
+    scheduleRefill();
+
+    if (w != nullptr) {
+        w->setVisible(true);
+    }
+    return w;
+}
+
+size_t WebViewPool::ready() const { return views.size(); }
+
+std::unique_ptr<WebView> WebViewPool::makeView() {
+    auto w = create ? create() : std::make_unique<WebView>();
+    if (w == nullptr) {
+        return nullptr;
+    }
+    w->setVisible(false);
+    if (w->init() == -1) {
+        return nullptr;
+    }
+    return w;
+}
+
+void WebViewPool::scheduleRefill() {
+    if (refillSource == 0 && views.size() < size) {
+        refillSource = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, refill_cb,
+                                       this, nullptr);
+    }
+}
+
+gboolean WebViewPool::refill_cb(gpointer arg) {
+    // One view per idle callback, so input and painting run in between
+    auto* pool = static_cast<WebViewPool*>(arg);
+    auto w = pool->makeView();
+    if (w == nullptr) {
+        pool->refillSource = 0;
+        return G_SOURCE_REMOVE;  // Try again on the next acquire
+    }
+    pool->views.push_back(std::move(w));
+
+    if (pool->views.size() < pool->size) {
+        return G_SOURCE_CONTINUE;
+    }
+    pool->refillSource = 0;
+    return G_SOURCE_REMOVE;
+}
+
+ResponseCache::ResponseCache(size_t maxBytes_) : maxBytes(maxBytes_) {}
+
+std::optional<SchemeResponse> ResponseCache::lookup(const std::string& url) {
+    auto it = urls.find(url);
+    if (it == urls.end()) {
+        counters.misses++;
+        return std::nullopt;
+    }
+    counters.hits++;
+
+    Body& body = bodies.at(it->second);
+    lru.splice(lru.begin(), lru, body.lru);
+
+    // The response keeps the body alive, even if it is evicted meanwhile
+    SchemeResponse res;
+    res.data = body.data->data();
+    res.size = body.data->size();
+    res.owner = body.data;
+    res.mime = body.mime;
+    res.gzip = body.gzip;
+    return res;
+}
+
+void ResponseCache::store(const std::string& url, const SchemeResponse& res) {
+    if (res.status != 200 || res.size > maxBytes ||
+        (res.data == nullptr && res.size != 0)) {
+        return;
+    }
+
+    gchar* checksum = g_compute_checksum_for_data(
+        G_CHECKSUM_SHA256, static_cast<const guchar*>(res.data), res.size);
+    std::string hash = checksum;
+    g_free(checksum);
+    hash += res.gzip ? ":gzip:" : ":";
+    hash += res.mime;
+
+    auto known = urls.find(url);
+    if (known != urls.end() && known->second == hash) {
+        return;
+    }
+    unlink(url);
+
+    auto it = bodies.find(hash);
+    if (it == bodies.end()) {
+        // New content is copied once, then shared by every URL and view
+        Body body{std::make_shared<const std::string>(
+                      static_cast<const char*>(res.data), res.size),
+                  res.mime,
+                  res.gzip,
+                  {},
+                  {}};
+        lru.push_front(hash);
+        body.lru = lru.begin();
+        counters.bytes += res.size;
+        it = bodies.emplace(hash, std::move(body)).first;
+    } else {
+        lru.splice(lru.begin(), lru, it->second.lru);
+    }
+    it->second.urls.push_back(url);
+    urls[url] = hash;
+
+    while (counters.bytes > maxBytes) {
+        erase(lru.back());
+        counters.evictions++;
+    }
+}
 
-    auto onWebViewControllerCreate =
-        [this, onWebMessageReceieved](
-            HRESULT result, ICoreWebView2Controller* controller) -> HRESULT {
-        if (FAILED(result)) {
-            return result;
+void ResponseCache::clear() {
+    urls.clear();
+    bodies.clear();
+    lru.clear();
+    counters.bytes = 0;
+}
+
+ResponseCache::Stats ResponseCache::stats() const {
+    Stats s = counters;
+    s.urls = urls.size();
+    s.bodies = bodies.size();
+    return s;
+}
+
+void ResponseCache::unlink(const std::string& url) {
+    auto it = urls.find(url);
+    if (it == urls.end()) {
+        return;
+    }
+    std::string hash = std::move(it->second);
+    urls.erase(it);
+
+    std::vector<std::string>& bodyUrls = bodies.at(hash).urls;
+    bodyUrls.erase(std::find(bodyUrls.begin(), bodyUrls.end(), url));
+    if (bodyUrls.empty()) {
+        erase(hash);
+    }
+}
+
+void ResponseCache::erase(std::string hash) {
+    // Taken by value, as callers pass a string owned by lru
+    Body& body = bodies.at(hash);
+    for (const std::string& url : body.urls) {
+        urls.erase(url);
+    }
+    counters.bytes -= body.data->size();
+    lru.erase(body.lru);
+    bodies.erase(hash);
+}
+
+BatchRenderer::BatchRenderer(RenderOptions options_)
+    : options(options_), slots(std::max<size_t>(options_.views, 1)) {}
+
+void BatchRenderer::add(RenderJob job) { queue.push_back(std::move(job)); }
+
+RenderStats BatchRenderer::run(donecb done_) {
+    using Clock = std::chrono::steady_clock;
+    done = std::move(done_);
+    stats = {};
+    auto begin = Clock::now();
+
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (!start(i)) {
+            // No display, nothing can be rendered
+            while (!queue.empty()) {
+                if (done) {
+                    done(queue.front(), false);
+                }
+                queue.pop_front();
+                stats.failed++;
+            }
         }
+    }
 
-        if (controller != nullptr) {
-            webviewController = controller;
-            webviewController->get_CoreWebView2(&webviewWindow);
+    // Every view runs on the default main context, so one loop drives them
+    auto busy = [&]() {
+        return std::any_of(slots.begin(), slots.end(),
+                           [](const Slot& slot) { return slot.busy; });
+    };
+    while (busy()) {
+        for (const Slot& slot : slots) {
+            if (slot.view != nullptr) {
+                slot.view->runFor(std::chrono::milliseconds(50));
+                break;
+            }
+        }
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i].busy && Clock::now() > slots[i].deadline) {
+                finish(i, slots[i].generation, false);
+            }
         }
+    }
 
-        wil::com_ptr<ICoreWebView2Settings> settings;
-        webviewWindow->get_Settings(&settings);
-        if (!debug) {
-            settings->put_AreDevToolsEnabled(FALSE);
+    stats.seconds =
+        std::chrono::duration<double>(Clock::now() - begin).count();
+    done = nullptr;
+    return stats;
+}
+
+bool BatchRenderer::start(size_t i) {
+    Slot& slot = slots[i];
+    slot.busy = false;
+    if (queue.empty()) {
+        return true;
+    }
+
+    slot.job = std::move(queue.front());
+    queue.pop_front();
+    slot.busy = true;
+    slot.committed = false;
+    slot.loaded = false;
+    slot.signalled = false;
+    slot.rendering = false;
+    slot.deadline = std::chrono::steady_clock::now() + options.timeout;
+    std::string url =
+        slot.job.url.empty() ? dataUrl(slot.job.html) : slot.job.url;
+
+    if (slot.view != nullptr) {
+        slot.view->navigate(url);
+        return true;
+    }
+
+    // The first page is loaded by init
+    auto w = std::make_unique<WebView>(options.width, options.height, false,
+                                       false, "BatchRenderer", url);
+    w->setHeadless(true);
+    w->addUserScript(
+        "window.renderReady=()=>"
+        "window.external.invoke('__webview_render:ready');"
+        "window.addEventListener('load',"
+        "()=>window.external.invoke('__webview_render:load'));");
+    w->setCallback(
+        [this, i](WebView&, std::string_view msg) { message(i, msg); });
+    w->onCommitted = [this, i](WebView&) {
+        Slot& s = slots[i];
+        s.committed = true;
+        s.loaded = false;
+        s.signalled = false;
+    };
+    if (w->init() == -1) {
+        queue.push_front(std::move(slot.job));
+        slot.busy = false;
+        return false;
+    }
+    slot.view = std::move(w);
+    return true;
+}
+
+void BatchRenderer::message(size_t i, std::string_view msg) {
+    // Until the job's page is committed, messages come from the previous
+    // one, e.g. a late load event of a page that timed out. Messages of
+    // the page itself are ignored.
+    Slot& slot = slots[i];
+    if (!slot.busy || !slot.committed) {
+        return;
+    }
+    if (msg == "__webview_render:load") {
+        slot.loaded = true;
+    } else if (msg == "__webview_render:ready") {
+        slot.signalled = true;
+    } else {
+        return;
+    }
+    poll(i);
+}
+
+void BatchRenderer::poll(size_t i) {
+    Slot& slot = slots[i];
+    if (!slot.busy || slot.rendering || !slot.loaded ||
+        (options.waitForSignal && !slot.signalled)) {
+        return;
+    }
+    slot.rendering = true;
+
+    uint64_t generation = slot.generation;
+    if (slot.job.format == RenderFormat::Pdf) {
+        slot.view->printToPdf(slot.job.output,
+                              [this, i, generation](WebView&, bool ok) {
+                                  finish(i, generation, ok);
+                              });
+        return;
+    }
+
+    slot.view->snapshot(
+        SnapshotRegion::FullDocument,
+        [this, i, generation](WebView&, bool ok, const Bitmap& b) {
+            // A job that timed out meanwhile mustn't overwrite anything
+            if (slots[i].generation != generation) {
+                return;
+            }
+            if (ok) {
+                // WebKit's pixels go straight to the PNG encoder
+                cairo_surface_t* surface = cairo_image_surface_create_for_data(
+                    b.data, CAIRO_FORMAT_ARGB32, b.width, b.height, b.stride);
+                ok = cairo_surface_write_to_png(
+                         surface, slots[i].job.output.c_str()) ==
+                     CAIRO_STATUS_SUCCESS;
+                cairo_surface_destroy(surface);
+            }
+            finish(i, generation, ok);
+        });
+}
+
+void BatchRenderer::finish(size_t i, uint64_t generation, bool ok) {
+    Slot& slot = slots[i];
+    if (!slot.busy || slot.generation != generation) {
+        return;  // Timed out before
+    }
+    slot.generation++;
+    if (ok) {
+        stats.rendered++;
+    } else {
+        stats.failed++;
+    }
+    if (done) {
+        done(slot.job, ok);
+    }
+    start(i);
+}
+
+std::string BatchRenderer::dataUrl(const std::string& html) {
+    // Escape what would end the URL or be dropped from it, such as # and
+    // newlines
+    static constexpr char hex[] = "0123456789ABCDEF";
+    std::string url = "data:text/html;charset=utf-8,";
+    url.reserve(url.size() + html.size() + html.size() / 8);
+    for (char ch : html) {
+        auto c = static_cast<unsigned char>(ch);
+        if (c <= ' ' || c >= 0x7f || c == '%' || c == '#') {
+            url += '%';
+            url += hex[c >> 4];
+            url += hex[c & 0xf];
+        } else {
+            url += ch;
         }
+    }
+    return url;
+}
 
-        // Resize WebView
-        resize();
+WebKitWebContext* WebView::webContext() {
+    // One context for the process, so every window shares the network
+    // process, caches and scheme handlers
+    if (sharedContext != nullptr) {
+        return sharedContext;
+    }
 
-        webviewWindow->AddScriptToExecuteOnDocumentCreated(inject.c_str(),
-                                                           nullptr);
+    // Website data somewhere else needs a context of its own
+    const ContextOptions& options = contextOptions;
+    if (options.ephemeral) {
+        WebKitWebsiteDataManager* manager =
+            webkit_website_data_manager_new_ephemeral();
+        sharedContext =
+            webkit_web_context_new_with_website_data_manager(manager);
+        g_object_unref(manager);
+    } else if (!options.dataDirectory.empty() ||
+               !options.cacheDirectory.empty()) {
+        auto dir = [](const std::string& path) {
+            return path.empty() ? nullptr : path.c_str();
+        };
+        WebKitWebsiteDataManager* manager = webkit_website_data_manager_new(
+            "base-data-directory", dir(options.dataDirectory),
+            "base-cache-directory", dir(options.cacheDirectory), nullptr);
+        sharedContext =
+            webkit_web_context_new_with_website_data_manager(manager);
+        g_object_unref(manager);
+    } else {
+        sharedContext = webkit_web_context_get_default();
+    }
 
-        webviewWindow->add_WebMessageReceived(
-            Callback<ICoreWebView2WebMessageReceivedEventHandler>(
-                onWebMessageReceieved)
-                .Get(),
-            nullptr);
+    // Only read when a web view is created, so set everything before that
+    webkit_web_context_set_cache_model(sharedContext, options.cacheModel);
+    G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+    // Newer WebKit always uses a process per view (unless shared with
+    // shareWebProcess) and ignores these
+    webkit_web_context_set_process_model(sharedContext, options.processModel);
+    if (options.webProcessLimit != 0) {
+        webkit_web_context_set_web_process_count_limit(
+            sharedContext, options.webProcessLimit);
+    }
+    G_GNUC_END_IGNORE_DEPRECATIONS
+
+#if WEBKIT_CHECK_VERSION(2, 34, 0)
+    if (options.memoryLimit != 0 || options.conservativeThreshold != 0 ||
+        options.strictThreshold != 0 || options.pollInterval != 0) {
+        WebKitMemoryPressureSettings* settings =
+            webkit_memory_pressure_settings_new();
+        if (options.memoryLimit != 0) {
+            webkit_memory_pressure_settings_set_memory_limit(
+                settings, options.memoryLimit);
+        }
+        if (options.conservativeThreshold != 0) {
+            webkit_memory_pressure_settings_set_conservative_threshold(
+                settings, options.conservativeThreshold);
+        }
+        if (options.strictThreshold != 0) {
+            webkit_memory_pressure_settings_set_strict_threshold(
+                settings, options.strictThreshold);
+        }
+        if (options.pollInterval != 0) {
+            webkit_memory_pressure_settings_set_poll_interval(
+                settings, options.pollInterval);
+        }
+        // Applies to web processes started from now on
+        webkit_web_context_set_memory_pressure_settings(settings);
+        webkit_memory_pressure_settings_free(settings);
+    }
+#endif
 
-        // Detect fullscreen change from JS
-        webviewWindow->add_ContainsFullScreenElementChanged(
-            Callback<ICoreWebView2ContainsFullScreenElementChangedEventHandler>(
-                [this](ICoreWebView2*, IUnknown*) {
-                    if (fullscreenFromJS) {
-                        BOOL containsFs = false;
-                        webviewWindow->get_ContainsFullScreenElement(
-                            &containsFs);
-                        this->setFullscreen(containsFs);
-                    }
+    // WebKit has no disk cache quota, so an oversized cache is dropped
+    // before the first page uses it
+    if (options.diskCacheLimit != 0) {
+        pruneCache(options.diskCacheLimit);
+    }
+    return sharedContext;
+}
+
+void WebView::clearWebsiteData(int types, std::chrono::seconds modifiedWithin,
+                               clearcb done) {
+    // A timespan of 0 clears everything, however old
+    WebKitWebsiteDataManager* manager =
+        webkit_web_context_get_website_data_manager(webContext());
+    webkit_website_data_manager_clear(
+        manager, static_cast<WebKitWebsiteDataTypes>(types),
+        modifiedWithin.count() * G_TIME_SPAN_SECOND, nullptr,
+        website_data_cleared_cb, new clearcb(std::move(done)));
+}
+
+void WebView::website_data_cleared_cb(GObject* object, GAsyncResult* result,
+                                      gpointer arg) {
+    std::unique_ptr<clearcb> done(static_cast<clearcb*>(arg));
+    GError* error = nullptr;
+    bool ok = webkit_website_data_manager_clear_finish(
+        WEBKIT_WEBSITE_DATA_MANAGER(object), result, &error);
+    g_clear_error(&error);
+    if (*done) {
+        (*done)(ok);
+    }
+}
+
+uint64_t WebView::cacheSize() {
+    const gchar* dir = webkit_website_data_manager_get_disk_cache_directory(
+        webkit_web_context_get_website_data_manager(webContext()));
+    if (dir == nullptr) {
+        return 0;  // Ephemeral
+    }
+
+    namespace fs = std::filesystem;
+    uint64_t size = 0;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(
+             dir, fs::directory_options::skip_permission_denied, ec);
+         !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        auto bytes = it->is_regular_file(ec) ? it->file_size(ec) : 0;
+        if (!ec) {
+            size += bytes;
+        }
+        ec.clear();
+    }
+    return size;
+}
+
+void WebView::pruneCache(uint64_t limit, clearcb done) {
+    if (cacheSize() <= limit) {
+        if (done) {
+            done(true);
+        }
+        return;
+    }
+    clearWebsiteData(WEBKIT_WEBSITE_DATA_DISK_CACHE, {}, std::move(done));
+}
+
+bool WebView::setContextOptions(const ContextOptions& options) {
+    if (sharedContext != nullptr) {
+        return false;
+    }
+    contextOptions = options;
+    return true;
+}
+
+ContextOptions ContextOptions::kiosk() {
+    // No navigation history worth caching, and nothing else to share with
+    ContextOptions options;
+    options.cacheModel = WEBKIT_CACHE_MODEL_DOCUMENT_VIEWER;
+    return options;
+}
+
+ContextOptions ContextOptions::dashboard() {
+    // Panes are reloaded rather than navigated back to, so a moderate
+    // resource cache, and a cap so idle panes give memory back
+    ContextOptions options;
+    options.cacheModel = WEBKIT_CACHE_MODEL_DOCUMENT_BROWSER;
+    options.memoryLimit = 1024;
+    options.conservativeThreshold = 0.5;
+    options.strictThreshold = 0.75;
+    return options;
+}
+
+ContextOptions ContextOptions::lowMemory() {
+    ContextOptions options;
+    options.cacheModel = WEBKIT_CACHE_MODEL_DOCUMENT_VIEWER;
+    options.memoryLimit = 256;
+    options.conservativeThreshold = 0.33;
+    options.strictThreshold = 0.5;
+    options.pollInterval = 5;
+    return options;
+}
+
+void WebView::registerScheme(const std::string& scheme, schemecb handler) {
+    schemeHandlers[scheme] = std::move(handler);
+    if (init_done) {
+        addContextScheme(scheme);
+    }
+}
+
+void WebView::serveAssets(const std::string& scheme, const AssetPack& assets) {
+    registerScheme(scheme, [assets](const SchemeRequest& req) {
+        SchemeResponse res;
+        std::string_view path = req.path;
+        if (path.empty() || path == "/") {
+            path = "/index.html";
+        }
+
+        auto asset = assets.find(path);
+        if (!asset) {
+            res.status = 404;
+            return res;
+        }
+
+        // Asset data is static, so it doesn't need an owner
+        res.data = asset->data;
+        res.size = asset->size;
+        res.mime = std::string(asset->mime);
+        res.gzip = asset->gzip;
+        return res;
+    });
+}
+
+void WebView::serveCached(const std::string& scheme,
+                          std::shared_ptr<ResponseCache> cache,
+                          schemecb fetch) {
+    registerScheme(scheme, [cache = std::move(cache), fetch = std::move(fetch)](
+                               const SchemeRequest& req) {
+        if (req.method != "GET") {
+            return fetch(req);
+        }
+        if (auto res = cache->lookup(req.uri)) {
+            return *res;
+        }
+        SchemeResponse res = fetch(req);
+        cache->store(req.uri, res);
+        return res;
+    });
+}
+
+void WebView::registerUpload(const std::string& scheme, uploadcb handler) {
+    uploadHandlers[scheme] = std::move(handler);
+    if (init_done) {
+        addContextScheme(scheme);
+    }
+}
+
+void WebView::addContextScheme(const std::string& scheme) {
+    WebKitWebContext* context =
+        webkit_web_view_get_context(WEBKIT_WEB_VIEW(webview));
+
+    // Schemes can only be registered once per context, so one handler
+    // dispatches to whichever WebView made the request
+    std::string key = "wv-scheme-" + scheme;
+    if (g_object_get_data(G_OBJECT(context), key.c_str()) != nullptr) {
+        return;
+    }
+    g_object_set_data(G_OBJECT(context), key.c_str(), GINT_TO_POINTER(1));
+
+    webkit_web_context_register_uri_scheme(
+        context, scheme.c_str(), uri_scheme_request_cb, nullptr, nullptr);
+
+    // Allow fetch() and friends from pages served by the scheme
+    WebKitSecurityManager* security =
+        webkit_web_context_get_security_manager(context);
+    webkit_security_manager_register_uri_scheme_as_secure(security,
+                                                          scheme.c_str());
+    webkit_security_manager_register_uri_scheme_as_cors_enabled(
+        security, scheme.c_str());
+}
+
+void WebView::external_message_received_cb(WebKitUserContentManager*,
+                                           WebKitJavascriptResult* r,
+                                           gpointer arg) {
+    WebView* w = static_cast<WebView*>(arg);
+    JSCValue* value = webkit_javascript_result_get_js_value(r);
+    gchar* chars = jsc_value_to_string(value);
+    w->onMessage(chars);
+    g_free(chars);
+}
+
+void WebView::webview_after_paint_cb(GdkFrameClock* clock, gpointer arg) {
+    WebView* w = static_cast<WebView*>(arg);
+    markPhase(w->metrics.firstPaint);
+    g_signal_handler_disconnect(clock, w->paintHandler);
+    w->paintClock = nullptr;
+    w->paintHandler = 0;
+    w->dumpStartupTrace();
+}
+
+void WebView::dumpStartupTrace() const {
+    // Written again when a later phase happens, so it ends up complete
+    const char* path = std::getenv("WEBVIEW_STARTUP_TRACE");
+    if (path != nullptr && *path != '\0') {
+        std::string trace = metrics.trace();
+        g_file_set_contents(path, trace.c_str(),
+                            static_cast<gssize>(trace.size()), nullptr);
+    }
+}
+
+void WebView::markPhase(StartupMetrics::time_point& phase) {
+    // Only the first time counts
+    if (phase == StartupMetrics::time_point{}) {
+        phase = std::chrono::steady_clock::now();
+    }
+}
+
+StartupMetrics WebView::startupMetrics() const { return metrics; }
+
+std::string StartupMetrics::trace() const {
+    // Each phase is a slice from the end of the last one that happened
+    const std::pair<const char*, time_point> phases[] = {
+        {"gtk_init_check", gtkInit},
+        {"Create window", windowCreated},
+        {"Set up content manager", contentManager},
+        {"Create web view", webViewCreated},
+        {"Navigate", navigate},
+        {"Load started", loadStarted},
+        {"Load committed", loadCommitted},
+        {"Load finished", loadFinished},
+        {"First paint", firstPaint},
+    };
+
+    using std::chrono::microseconds;
+    auto since = [this](time_point t) {
+        return std::chrono::duration_cast<microseconds>(t - initStart).count();
+    };
+
+    std::string out = "{\"traceEvents\":[";
+    time_point last = initStart;
+    bool first = true;
+    for (const auto& [name, end] : phases) {
+        if (end == time_point{}) {
+            continue;
+        }
+        if (!first) {
+            out += ',';
+        }
+        first = false;
+        out += "{\"name\":";
+        json::write(out, std::string_view(name));
+        out += ",\"cat\":\"startup\",\"ph\":\"X\",\"pid\":1,\"tid\":1";
+        out += ",\"ts\":" + std::to_string(since(last));
+        out += ",\"dur\":" + std::to_string(since(end) - since(last)) + "}";
+        last = end;
+    }
+    out += "]}";
+    return out;
+}
+
+void WebView::webview_eval_finished(GObject* object, GAsyncResult* result,
+                                    gpointer arg) {
+    WebKitJavascriptResult* r = webkit_web_view_run_javascript_finish(
+        WEBKIT_WEB_VIEW(object), result, NULL);
+    if (r != nullptr) {
+        webkit_javascript_result_unref(r);
+    }
+    static_cast<WebView*>(arg)->js_busy = false;
+}
+
+void WebView::webview_eval_async_finished(GObject* object,
+                                          GAsyncResult* result, gpointer arg) {
+    std::unique_ptr<EvalRequest> req(static_cast<EvalRequest*>(arg));
+
+    GError* error = nullptr;
+    WebKitJavascriptResult* r = webkit_web_view_run_javascript_finish(
+        WEBKIT_WEB_VIEW(object), result, &error);
+    finishEval(*req, r != nullptr ? webkit_javascript_result_get_js_value(r)
+                                  : nullptr,
+               error);
+    if (r != nullptr) {
+        webkit_javascript_result_unref(r);
+    }
+}
+
+void WebView::finishEval(EvalRequest& req, JSCValue* value, GError* error) {
+    if (value == nullptr) {
+        // The WebView is gone
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_error_free(error);
+            return;
+        }
+        if (req.callback) {
+            std::string msg = error->message;
+            req.callback(*req.w, false, msg);
+        }
+        g_error_free(error);
+        return;
+    }
+
+    if (req.callback) {
+        // undefined has no JSON representation, report it as null
+        gchar* json = jsc_value_to_json(value, 0);
+        std::string str = json != nullptr ? json : "null";
+        g_free(json);
+        req.callback(*req.w, true, str);
+    }
+}
+
+WebKitUserScript* WebView::newUserScript(const UserScriptSource& script) {
+    return webkit_user_script_new(
+        script.js.c_str(),
+        script.frames == InjectFrames::TopFrame
+            ? WEBKIT_USER_CONTENT_INJECT_TOP_FRAME
+            : WEBKIT_USER_CONTENT_INJECT_ALL_FRAMES,
+        script.time == InjectTime::DocumentStart
+            ? WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START
+            : WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_END,
+        nullptr, nullptr);
+}
+
+void WebView::updateUserScript(uint64_t id) {
+    if (!init_done) {
+        return;  // Added by init
+    }
+    WebKitUserContentManager* cm =
+        webkit_web_view_get_user_content_manager(WEBKIT_WEB_VIEW(webview));
+
+    // Scripts are never changed in place, so only the one script is added
+    // or removed and the others stay as they are
+    auto native = nativeUserScripts.find(id);
+    if (native != nativeUserScripts.end()) {
+        webkit_user_content_manager_remove_script(cm, native->second);
+        webkit_user_script_unref(native->second);
+        nativeUserScripts.erase(native);
+    }
+
+    auto it = userScripts.find(id);
+    if (it != userScripts.end()) {
+        WebKitUserScript* script = newUserScript(it->second);
+        nativeUserScripts.emplace(id, script);
+        webkit_user_content_manager_add_script(cm, script);
+    }
+}
+
+void WebView::updateStyleSheet(uint64_t id) {
+    auto native = nativeStyleSheets.find(id);
+    bool existed = native != nativeStyleSheets.end();
+    if (existed) {
+        webkit_user_style_sheet_unref(native->second);
+        nativeStyleSheets.erase(native);
+    }
+    if (!init_done) {
+        return;  // Added by init
+    }
+
+    // A new stylesheet goes last, anything else changes the cascade order
+    // unless every stylesheet is added again
+    auto it = styleSheets.find(id);
+    if (!existed && it != styleSheets.end() &&
+        std::next(it) == styleSheets.end()) {
+        WebKitUserStyleSheet* sheet = webkit_user_style_sheet_new(
+            it->second.c_str(), WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+            WEBKIT_USER_STYLE_LEVEL_AUTHOR, nullptr, nullptr);
+        nativeStyleSheets.emplace(id, sheet);
+        webkit_user_content_manager_add_style_sheet(
+            webkit_web_view_get_user_content_manager(WEBKIT_WEB_VIEW(webview)),
+            sheet);
+    } else {
+        loadStyleSheets();
+    }
+}
+
+void WebView::loadStyleSheets() {
+    WebKitUserContentManager* cm =
+        webkit_web_view_get_user_content_manager(WEBKIT_WEB_VIEW(webview));
+    webkit_user_content_manager_remove_all_style_sheets(cm);
+
+    for (const auto& [id, css] : styleSheets) {
+        auto& sheet = nativeStyleSheets[id];
+        if (sheet == nullptr) {
+            sheet = webkit_user_style_sheet_new(
+                css.c_str(), WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+                WEBKIT_USER_STYLE_LEVEL_AUTHOR, nullptr, nullptr);
+        }
+        webkit_user_content_manager_add_style_sheet(cm, sheet);
+    }
+}
+
+#if WEBKIT_CHECK_VERSION(2, 40, 0)
+void WebView::runFunction(uint64_t id, const std::string& args,
+                          evalcb callback) {
+    // The body is the same for every call, so the engine compiles it once.
+    // Arguments come in as a string, which JSON.parse reads much faster
+    // than the JS parser would read the same values as source.
+    static constexpr auto body =
+        "return window.__webview_fn[i](...JSON.parse(a))";
+
+    GVariantDict dict;
+    g_variant_dict_init(&dict, nullptr);
+    g_variant_dict_insert_value(&dict, "i",
+                                g_variant_new_double(static_cast<double>(id)));
+    g_variant_dict_insert_value(&dict, "a", g_variant_new_string(args.c_str()));
+    webkit_web_view_call_async_javascript_function(
+        WEBKIT_WEB_VIEW(webview), body, -1, g_variant_dict_end(&dict), nullptr,
+        nullptr, cancellable, webview_call_finished,
+        new EvalRequest{this, std::move(callback)});
+}
+
+void WebView::webview_call_finished(GObject* object, GAsyncResult* result,
+                                    gpointer arg) {
+    std::unique_ptr<EvalRequest> req(static_cast<EvalRequest*>(arg));
+
+    // Since 2.40 results are plain JSCValues, thrown exceptions included
+    GError* error = nullptr;
+    JSCValue* value = webkit_web_view_call_async_javascript_function_finish(
+        WEBKIT_WEB_VIEW(object), result, &error);
+    finishEval(*req, value, error);
+    if (value != nullptr) {
+        g_object_unref(value);
+    }
+}
+#endif
+
+void WebView::snapshot(SnapshotRegion region, snapshotcb callback,
+                       Bitmap target) {
+    bool badTarget = target.data != nullptr &&
+                     (target.width <= 0 || target.height <= 0 ||
+                      target.stride < target.width * 4 || target.stride % 4);
+    if (!init_done || badTarget) {
+        callback(*this, false, Bitmap{});
+        return;
+    }
+
+    webkit_web_view_get_snapshot(
+        WEBKIT_WEB_VIEW(webview),
+        region == SnapshotRegion::Visible
+            ? WEBKIT_SNAPSHOT_REGION_VISIBLE
+            : WEBKIT_SNAPSHOT_REGION_FULL_DOCUMENT,
+        WEBKIT_SNAPSHOT_OPTIONS_NONE, cancellable, webview_snapshot_finished,
+        new SnapshotRequest{this, std::move(callback), target});
+}
+
+void WebView::webview_snapshot_finished(GObject* object, GAsyncResult* result,
+                                        gpointer arg) {
+    std::unique_ptr<SnapshotRequest> req(static_cast<SnapshotRequest*>(arg));
+
+    GError* error = nullptr;
+    cairo_surface_t* surface = webkit_web_view_get_snapshot_finish(
+        WEBKIT_WEB_VIEW(object), result, &error);
+    if (surface == nullptr) {
+        // The WebView is gone
+        bool cancelled =
+            g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+        g_error_free(error);
+        if (!cancelled) {
+            req->callback(*req->w, false, Bitmap{});
+        }
+        return;
+    }
+
+    bool ok = drawSnapshot(surface, req->target);
+    req->callback(*req->w, ok, ok ? req->target : Bitmap{});
+    cairo_surface_destroy(surface);
+}
+
+bool WebView::drawSnapshot(cairo_surface_t* surface, Bitmap& target) {
+    cairo_surface_flush(surface);
+    int width = cairo_image_surface_get_width(surface);
+    int height = cairo_image_surface_get_height(surface);
+    if (width <= 0 || height <= 0) {
+        return false;
+    }
+
+    // Without a target, hand out WebKit's own pixels instead of a copy
+    if (target.data == nullptr) {
+        target.data = cairo_image_surface_get_data(surface);
+        target.width = width;
+        target.height = height;
+        target.stride = cairo_image_surface_get_stride(surface);
+        return target.data != nullptr;
+    }
+
+    // Otherwise draw straight into the target, scaled down to fit it
+    double scale = std::min({1.0, target.width / static_cast<double>(width),
+                             target.height / static_cast<double>(height)});
+    target.width = std::max(1, static_cast<int>(width * scale));
+    target.height = std::max(1, static_cast<int>(height * scale));
+
+    cairo_surface_t* out = cairo_image_surface_create_for_data(
+        target.data, CAIRO_FORMAT_ARGB32, target.width, target.height,
+        target.stride);
+    cairo_t* cr = cairo_create(out);
+    cairo_scale(cr, scale, scale);
+    cairo_set_source_surface(cr, surface, 0, 0);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairo_surface_flush(out);
+    bool ok = cairo_surface_status(out) == CAIRO_STATUS_SUCCESS;
+    cairo_surface_destroy(out);
+    return ok;
+}
+
+void WebView::printToPdf(const std::string& path, printcb callback) {
+    gchar* absolute = g_canonicalize_filename(path.c_str(), nullptr);
+    gchar* uri = g_filename_to_uri(absolute, nullptr, nullptr);
+    g_free(absolute);
+    if (!init_done || uri == nullptr || filePrinter().empty()) {
+        g_free(uri);
+        callback(*this, false);
+        return;
+    }
+
+    // The file printer writes the PDF without showing a dialog
+    GtkPrintSettings* settings = gtk_print_settings_new();
+    gtk_print_settings_set_printer(settings, filePrinter().c_str());
+    gtk_print_settings_set(settings, GTK_PRINT_SETTINGS_OUTPUT_FILE_FORMAT,
+                           "pdf");
+    gtk_print_settings_set(settings, GTK_PRINT_SETTINGS_OUTPUT_URI, uri);
+    g_free(uri);
+
+    WebKitPrintOperation* op =
+        webkit_print_operation_new(WEBKIT_WEB_VIEW(webview));
+    webkit_print_operation_set_print_settings(op, settings);
+    g_object_unref(settings);
+
+    auto* req = new PrintRequest{this, std::move(callback)};
+    prints.push_back(req);
+    g_signal_connect(op, "failed", G_CALLBACK(print_failed_cb), req);
+    g_signal_connect(op, "finished", G_CALLBACK(print_finished_cb), req);
+    webkit_print_operation_print(op);
+}
+
+const std::string& WebView::filePrinter() {
+    // Its name is translated ("Print to File" in English), so look for
+    // what it is instead. Enumerating waits for every print backend, so
+    // it's only done once.
+    static const std::string name = [] {
+        std::string found;
+        gtk_enumerate_printers(file_printer_cb, &found, nullptr, TRUE);
+        return found;
+    }();
+    return name;
+}
+
+gboolean WebView::file_printer_cb(GtkPrinter* printer, gpointer arg) {
+    if (!gtk_printer_is_virtual(printer) || !gtk_printer_accepts_pdf(printer)) {
+        return FALSE;  // Keep looking
+    }
+    *static_cast<std::string*>(arg) = gtk_printer_get_name(printer);
+    return TRUE;
+}
+
+void WebView::print_failed_cb(WebKitPrintOperation*, GError*, gpointer arg) {
+    // finished follows
+    static_cast<PrintRequest*>(arg)->failed = true;
+}
+
+void WebView::print_finished_cb(WebKitPrintOperation* op, gpointer arg) {
+    std::unique_ptr<PrintRequest> req(static_cast<PrintRequest*>(arg));
+    g_object_unref(op);
+    if (req->w == nullptr) {
+        return;  // The WebView is gone
+    }
+
+    auto& prints = req->w->prints;
+    prints.erase(std::find(prints.begin(), prints.end(), req.get()));
+    req->callback(*req->w, !req->failed);
+}
+
+void WebView::webview_load_changed_cb(WebKitWebView*, WebKitLoadEvent event,
+                                      gpointer arg) {
+    WebView* w = static_cast<WebView*>(arg);
+    if (event == WEBKIT_LOAD_COMMITTED && w->onCommitted) {
+        w->onCommitted(*w);
+    }
 
-                    return S_OK;
-                })
-                .Get(),
-            nullptr);
+    if (event == WEBKIT_LOAD_STARTED) {
+        markPhase(w->metrics.loadStarted);
+    } else if (event == WEBKIT_LOAD_COMMITTED &&
+               w->metrics.loadCommitted == StartupMetrics::time_point{}) {
+        markPhase(w->metrics.loadCommitted);
+
+        // Hidden windows have no frame clock, and don't paint
+        w->paintClock = gtk_widget_get_frame_clock(w->webview);
+        if (w->paintClock != nullptr) {
+            w->paintHandler =
+                g_signal_connect(w->paintClock, "after-paint",
+                                 G_CALLBACK(webview_after_paint_cb), w);
+        }
+    }
 
-        // Done initialization, set properties
-        init_done = true;
+    if (event == WEBKIT_LOAD_FINISHED) {
+        if (w->metrics.loadFinished == StartupMetrics::time_point{}) {
+            markPhase(w->metrics.loadFinished);
+            w->dumpStartupTrace();
+        }
+        w->ready = true;
 
-        setTitle(title);
-        if (fullscreen) {
-            setFullscreen(true);
+        auto pending = std::move(w->pendingEvals);
+        w->pendingEvals.clear();
+        for (auto& [js, callback] : pending) {
+            w->runScript(js, std::move(callback));
         }
-        setBgColor(bgR, bgG, bgB, bgA);
-        navigate(url);
+    }
+}
 
-        return S_OK;
-    };
+void WebView::uri_scheme_request_cb(WebKitURISchemeRequest* request,
+                                    gpointer) {
+    WebKitWebView* view = webkit_uri_scheme_request_get_web_view(request);
+    WebView* w = view == nullptr ? nullptr
+                                 : static_cast<WebView*>(g_object_get_data(
+                                       G_OBJECT(view), "wv-webview"));
+
+    std::string scheme = webkit_uri_scheme_request_get_scheme(request);
+    schemecb* handler = nullptr;
+    if (w != nullptr) {
+#if WEBKIT_CHECK_VERSION(2, 40, 0)
+        // Requests with a body go to the upload handler, if there is one
+        auto upload = w->uploadHandlers.find(scheme);
+        GInputStream* body =
+            upload == w->uploadHandlers.end()
+                ? nullptr
+                : webkit_uri_scheme_request_get_http_body(request);
+        if (body != nullptr) {
+            g_object_ref(request);
+            readUpload(new Upload{request, body,
+                                  upload->second(makeSchemeRequest(request))});
+            return;
+        }
+#endif
 
-    auto onCreateEnvironment = [this, onWebViewControllerCreate](
-                                   HRESULT result,
-                                   ICoreWebView2Environment* env) -> HRESULT {
-        if (result == HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND)) {
-            MessageBox(nullptr, L"Could not find Edge installation.", L"Error!",
-                       NULL);
-            return result;
+        auto it = w->schemeHandlers.find(scheme);
+        if (it != w->schemeHandlers.end()) {
+            handler = &it->second;
         }
+    }
 
-        // Create Webview2 controller
-        return env->CreateCoreWebView2Controller(
-            hwnd,
-            Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
-                onWebViewControllerCreate)
-                .Get());
-    };
+    if (handler == nullptr) {
+        GError* error = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                            "No handler for scheme");
+        webkit_uri_scheme_request_finish_error(request, error);
+        g_error_free(error);
+        return;
+    }
 
-    // Get APPDATA path
-    PCWSTR userDataFolderPtr = nullptr;
-    std::wstring userDataFolder;
+    SchemeResponse res = (*handler)(makeSchemeRequest(request));
+    finishSchemeRequest(request, res);
+}
 
-    DWORD bufferLength = 32767;
-    std::wstring appdataPath;
-    appdataPath.resize(bufferLength);
-    bufferLength = GetEnvironmentVariable(Str("APPDATA"), appdataPath.data(),
-                                          bufferLength);
-    if (bufferLength) {
-        appdataPath.resize(bufferLength);
+SchemeRequest WebView::makeSchemeRequest(WebKitURISchemeRequest* request) {
+    SchemeRequest req;
+    req.uri = webkit_uri_scheme_request_get_uri(request);
+    req.path = webkit_uri_scheme_request_get_path(request);
+#if WEBKIT_CHECK_VERSION(2, 36, 0)
+    req.method = webkit_uri_scheme_request_get_http_method(request);
+#else
+    req.method = "GET";
+#endif
+    return req;
+}
 
-        // Get executable file name
-        wchar_t exePath[MAX_PATH];
-        GetModuleFileName(NULL, exePath, MAX_PATH);
-        userDataFolder = (appdataPath + Str("/") + PathFindFileName(exePath));
-        userDataFolderPtr = userDataFolder.c_str();
+void WebView::readUpload(Upload* upload) {
+    // Only one chunk is in memory at a time, whatever the body size
+    g_input_stream_read_bytes_async(upload->body, uploadChunkSize,
+                                    G_PRIORITY_DEFAULT, nullptr,
+                                    upload_read_cb, upload);
+}
+
+void WebView::upload_read_cb(GObject* object, GAsyncResult* result,
+                             gpointer arg) {
+    std::unique_ptr<Upload> upload(static_cast<Upload*>(arg));
+    UploadSink& sink = upload->sink;
+
+    GError* error = nullptr;
+    GBytes* bytes = g_input_stream_read_bytes_finish(G_INPUT_STREAM(object),
+                                                     result, &error);
+    if (bytes == nullptr) {
+        if (sink.onError) {
+            sink.onError(error->message);
+        }
+        webkit_uri_scheme_request_finish_error(upload->request, error);
+        g_error_free(error);
+        return;
     }
 
-    // Create WebView2 environment
-    auto hr = CreateCoreWebView2EnvironmentWithOptions(
-        nullptr, userDataFolderPtr, nullptr,
-        Callback<ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler>(
-            onCreateEnvironment)
-            .Get());
+    gsize size = 0;
+    const void* data = g_bytes_get_data(bytes, &size);
+    if (size == 0) {
+        // End of the body
+        g_bytes_unref(bytes);
+        SchemeResponse res = sink.onEnd ? sink.onEnd() : SchemeResponse{};
+        finishSchemeRequest(upload->request, res);
+        return;
+    }
 
-    if (FAILED(hr)) {
-        CoUninitialize();
-        return -1;
+    bool keep = !sink.onData ||
+                sink.onData({static_cast<const char*>(data), size});
+    g_bytes_unref(bytes);
+    if (!keep) {
+        error = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                    "Upload rejected");
+        webkit_uri_scheme_request_finish_error(upload->request, error);
+        g_error_free(error);
+        return;
     }
 
-    return 0;
+    readUpload(upload.release());
 }
 
-void WebView::setFullscreenFromJS(bool allow) { fullscreenFromJS = allow; }
+// Parses a single "bytes=start-end" range into [start, end).
+// Returns false if the range can't be satisfied.
+bool parseByteRange(const char* header, size_t size, size_t& start,
+                    size_t& end) {
+    std::string range = header;
+    if (range.rfind("bytes=", 0) != 0 ||
+        range.find(',') != std::string::npos) {
+        return false;
+    }
 
-void WebView::setBgColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
-    if (!init_done) {
-        bgR = r;
-        bgG = g;
-        bgB = b;
-        bgA = a;
-    } else {
-        // TODO
+    auto dash = range.find('-', 6);
+    if (dash == std::string::npos) {
+        return false;
+    }
+
+    std::string first = range.substr(6, dash - 6);
+    std::string last = range.substr(dash + 1);
+    try {
+        if (first.empty()) {
+            // Suffix range: the last n bytes
+            size_t n = std::stoull(last);
+            start = n < size ? size - n : 0;
+            end = size;
+        } else {
+            start = std::stoull(first);
+            end = last.empty() ? size
+                               : std::min<size_t>(std::stoull(last) + 1, size);
+        }
+    } catch (std::exception&) {
+        return false;
     }
+    return start < end;
 }
 
-void WebView::navigate(std::wstring u) {
-    if (!init_done) {
-        url = u;
+void WebView::finishSchemeRequest(WebKitURISchemeRequest* request,
+                                  SchemeResponse& res) {
+    size_t start = 0;
+    size_t end = res.size;
+    int status = res.status;
+    std::string contentRange;
+
+#if WEBKIT_CHECK_VERSION(2, 36, 0)
+    SoupMessageHeaders* requestHeaders =
+        webkit_uri_scheme_request_get_http_headers(request);
+    const char* range =
+        requestHeaders == nullptr
+            ? nullptr
+            : soup_message_headers_get_one(requestHeaders, "Range");
+
+    // Compressed bodies don't map onto byte ranges, so send them whole
+    if (range != nullptr && status == 200 && !res.gzip) {
+        if (parseByteRange(range, res.size, start, end)) {
+            status = 206;
+            contentRange = "bytes " + std::to_string(start) + "-" +
+                           std::to_string(end - 1) + "/" +
+                           std::to_string(res.size);
+        } else {
+            status = 416;
+            start = end = 0;
+            contentRange = "bytes */" + std::to_string(res.size);
+        }
+    }
+#endif
+
+    // Wrap the body without copying. The GBytes holds a reference to the
+    // owner until WebKit releases the stream.
+    const char* body = static_cast<const char*>(res.data) + start;
+    GBytes* bytes;
+    if (res.owner) {
+        bytes = g_bytes_new_with_free_func(
+            body, end - start,
+            [](gpointer owner) {
+                delete static_cast<std::shared_ptr<const void>*>(owner);
+            },
+            new std::shared_ptr<const void>(res.owner));
     } else {
-        webviewWindow->Navigate(u.c_str());
+        bytes = g_bytes_new_static(body, end - start);
     }
-}
 
-void WebView::eval(const std::wstring& js) {
-    // Schedule an async task to get the document URL
-    webviewWindow->ExecuteScript(
-        js.c_str(), Callback<ICoreWebView2ExecuteScriptCompletedHandler>(
-                        [](HRESULT, LPCWSTR) -> HRESULT {
-                            // LPCWSTR URL = resultObjectAsJson;
-                            // doSomethingWithURL(URL);
-                            return S_OK;
-                        })
-                        .Get());
+    GInputStream* stream = g_memory_input_stream_new_from_bytes(bytes);
+    g_bytes_unref(bytes);
+    gint64 length = static_cast<gint64>(end - start);
+
+    if (res.gzip) {
+        GZlibDecompressor* decompressor =
+            g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+        GInputStream* decompressed =
+            g_converter_input_stream_new(stream, G_CONVERTER(decompressor));
+        g_object_unref(decompressor);
+        g_object_unref(stream);
+        stream = decompressed;
+        length = -1;  // Unknown until decompressed
+    }
 
-    // if (debug) {
-    // std::cout << winrt::to_string(result) << std::endl;
-    //}
-}
+#if WEBKIT_CHECK_VERSION(2, 36, 0)
+    WebKitURISchemeResponse* response =
+        webkit_uri_scheme_response_new(stream, length);
+    webkit_uri_scheme_response_set_status(response, static_cast<guint>(status),
+                                          nullptr);
+    webkit_uri_scheme_response_set_content_type(response, res.mime.c_str());
+
+    SoupMessageHeaders* headers =
+        soup_message_headers_new(SOUP_MESSAGE_HEADERS_RESPONSE);
+    if (!res.gzip) {
+        soup_message_headers_append(headers, "Accept-Ranges", "bytes");
+    }
+    if (!contentRange.empty()) {
+        soup_message_headers_append(headers, "Content-Range",
+                                    contentRange.c_str());
+    }
+    webkit_uri_scheme_response_set_http_headers(response, headers);
 
-void WebView::exit() {
-    PostQuitMessage(WM_QUIT);
-    CoUninitialize();
+    webkit_uri_scheme_request_finish_with_response(request, response);
+    g_object_unref(response);
+#else
+    webkit_uri_scheme_request_finish(request, stream, length,
+                                     res.mime.c_str());
+#endif
+    g_object_unref(stream);
 }
 
-void WebView::resize() {
-    RECT rc;
-    GetClientRect(hwnd, &rc);
-    webviewController->put_Bounds(rc);
+gboolean WebView::dispatch_source_cb(GSource* source, GSourceFunc,
+                                     gpointer) {
+    // Disarm before draining, so a dispatch during the drain re-arms it
+    g_source_set_ready_time(source, -1);
+    reinterpret_cast<DispatchSource*>(source)->w->runDispatched();
+    return G_SOURCE_CONTINUE;
 }
-#elif defined(WEBVIEW_MAC)   // WEBVIEW_EDGE
-int WebView::init() {
-    // Initialize autorelease pool
-    pool = [NSAutoreleasePool new];
 
-    // Window style: titled, closable, minimizable
-    uint style = NSWindowStyleMaskTitled | NSWindowStyleMaskClosable |
-                 NSWindowStyleMaskMiniaturizable;
+void WebView::destroyWindowCb(GtkWidget*, gpointer arg) {
+    // GTK destroys the widgets, so the destructor mustn't touch them again
+    WebView* w = static_cast<WebView*>(arg);
+    w->detachWidgets();
+    w->exit();
+}
 
-    // Set window to be resizable
-    if (resizable) {
-        style |= NSWindowStyleMaskResizable;
+void WebView::detachWidgets() {
+    // Disconnect first, so destroying the window doesn't call back
+    if (paintHandler != 0) {
+        g_signal_handler_disconnect(paintClock, paintHandler);
+        paintHandler = 0;
     }
+    g_signal_handlers_disconnect_by_data(
+        webkit_web_view_get_user_content_manager(WEBKIT_WEB_VIEW(webview)),
+        this);
+    g_signal_handlers_disconnect_by_data(webview, this);
+    g_signal_handlers_disconnect_by_data(window, this);
+    g_object_set_data(G_OBJECT(webview), "wv-webview", nullptr);
+    window = nullptr;
+    webview = nullptr;
+}
 
-    // Initialize Cocoa window
-    window = [[NSWindow alloc]
-        // Initial window size
-        initWithContentRect:NSMakeRect(0, 0, width, height)
-                  // Window style
-                  styleMask:style
-                    backing:NSBackingStoreBuffered
-                      defer:NO];
+// gboolean WebView::closeWebViewCb(WebKitWebView *webView, GtkWidget *window) {
+//   gtk_widget_destroy(window);
+//   return TRUE;
+// }
 
-    // Minimum window size
-    [window setContentMinSize:NSMakeSize(width, height)];
+gboolean WebView::webview_context_menu_cb(WebKitWebView*, GtkWidget*,
+                                          WebKitHitTestResult*, gboolean,
+                                          gpointer) {
+    // Always hide context menu if not debug
+    return TRUE;
+}
 
-    // Position window in center of screen
-    [window center];
+gboolean WebView::webview_enter_fullscreen_cb(WebKitWebView*, gpointer arg) {
+    return !static_cast<WebView*>(arg)->fullscreenFromJS;
+}
 
-    // Initialize WKWebView
-    WKWebViewConfiguration* config = [WKWebViewConfiguration new];
-    WKPreferences* prefs = [config preferences];
-    [prefs setJavaScriptCanOpenWindowsAutomatically:NO];
-    if (debug) {
-        [prefs setValue:@YES forKey:@"developerExtrasEnabled"];
-    }
+gboolean WebView::webview_leave_fullscreen_cb(WebKitWebView*, gpointer arg) {
+    return !static_cast<WebView*>(arg)->fullscreenFromJS;
+}
+#endif                      // WEBVIEW_GTK
 
-    // Allow fullscreen control from JS
-    if (fullscreenFromJS) {
-        [prefs setValue:@YES forKey:@"fullScreenEnabled"];
+void WebView::css(const wv::String& css) {
+    // One rule on the current page only; addStyleSheet is the persistent
+    // version
+    String js = Str(R"js(
+    (
+      function (css) {
+        if (document.styleSheets.length === 0) {
+          var s = document.createElement('style');
+          s.type = 'text/css';
+          document.head.appendChild(s);
+        }
+        document.styleSheets[0].insertRule(css);
+      }
+    )()js");
+    json::write(js, css);
+    js += ')';
+    eval(js);
+}
+
+StyleSheet WebView::addStyleSheet(const String& css) {
+    StyleSheet sheet(++lastStyleSheetId);
+    styleSheets.emplace(sheet.id, css);
+    updateStyleSheet(sheet.id);
+    return sheet;
+}
+
+void WebView::replaceStyleSheet(const StyleSheet& sheet, const String& css) {
+    auto it = styleSheets.find(sheet.id);
+    if (it == styleSheets.end()) {
+        return;
     }
+    it->second = css;
+    updateStyleSheet(sheet.id);
+}
 
-    WKUserContentController* controller = [config userContentController];
-    // Add inject script
-    WKUserScript* userScript = [WKUserScript alloc];
-    [userScript initWithSource:[NSString stringWithUTF8String:inject.c_str()]
-                 injectionTime:WKUserScriptInjectionTimeAtDocumentStart
-              forMainFrameOnly:NO];
-    [controller addUserScript:userScript];
+void WebView::removeStyleSheet(StyleSheet& sheet) {
+    if (styleSheets.erase(sheet.id) != 0) {
+        updateStyleSheet(sheet.id);
+    }
+    sheet.id = 0;
+}
 
-    webview = [[WKWebView alloc] initWithFrame:NSZeroRect configuration:config];
+#if !defined(WEBVIEW_GTK)
+// Without native user stylesheets, each one is a <style> element that's
+// kept in place when replaced, so the cascade order doesn't change
+constexpr auto styleRuntime = Str(
+    "window.__webview_css=window.__webview_css||((id,css)=>{"
+    "const apply=()=>{let s=document.getElementById('__webview_css'+id);"
+    "if(css===null){if(s)s.remove();return;}"
+    "if(!s){s=document.createElement('style');s.id='__webview_css'+id;"
+    "(document.head||document.documentElement).appendChild(s);}"
+    "s.textContent=css;};"
+    "if(document.documentElement)apply();"
+    "else document.addEventListener('readystatechange',apply,{once:true});});");
+
+String WebView::injectScript() const {
+    String js = inject;
+    for (const auto& [id, script] : userScripts) {
+        if (script.time == InjectTime::DocumentStart &&
+            script.frames == InjectFrames::AllFrames) {
+            js += script.js;
+            js += Str("\n;");
+            continue;
+        }
 
-    // Add delegate methods manually in order to capture "this"
-    class_replaceMethod(
-        [WindowDelegate class], @selector(windowWillClose:),
-        imp_implementationWithBlock([=](id, SEL, id) { this->exit(); }),
-        "v@:@");
+        // Deferred or skipped scripts are still run with a global eval, so
+        // they're in the same scope as the others
+        if (script.frames == InjectFrames::TopFrame) {
+            js += Str("if(window===window.top)");
+        }
+        if (script.time == InjectTime::DocumentEnd) {
+            js += Str("document.addEventListener('DOMContentLoaded',()=>");
+        }
+        js += Str("(0,eval)(");
+        json::write(js, script.js);
+        js += ')';
+        if (script.time == InjectTime::DocumentEnd) {
+            js += ')';
+        }
+        js += ';';
+    }
 
-    class_replaceMethod(
-        [WindowDelegate class],
-        @selector(userContentController:didReceiveScriptMessage:),
-        imp_implementationWithBlock(
-            [=](id, SEL, WKScriptMessage* scriptMessage) {
-                if (this->js_callback) {
-                    id body = [scriptMessage body];
-                    if (![body isKindOfClass:[NSString class]]) {
-                        return;
-                    }
+    if (styleSheets.empty()) {
+        return js;
+    }
+    js += styleRuntime;
+    for (const auto& [id, css] : styleSheets) {
+        js += Str("window.__webview_css(");
+        json::write(js, id);
+        js += ',';
+        json::write(js, css);
+        js += Str(");");
+    }
+    return js;
+}
 
-                    std::string msg = [body UTF8String];
-                    this->js_callback(*this, msg);
-                }
-            }),
-        "v@:@");
+void WebView::updateUserScript(uint64_t) {
+    // Part of the inject script; pages that are already loaded keep the
+    // scripts they ran
+    if (init_done) {
+        addInjectScript();
+    }
+}
 
-    WindowDelegate* delegate = [WindowDelegate alloc];
-    [controller addScriptMessageHandler:delegate name:@"webview"];
-    // Set delegate to window
-    [window setDelegate:delegate];
+void WebView::updateStyleSheet(uint64_t id) {
+    if (!init_done) {
+        return;  // Added with the inject script
+    }
 
-    // Initialize application
-    [NSApplication sharedApplication];
-    [NSApp setActivationPolicy:NSApplicationActivationPolicyRegular];
+    String js = styleRuntime;
+    js += Str("window.__webview_css(");
+    json::write(js, id);
+    js += ',';
+    auto it = styleSheets.find(id);
+    if (it != styleSheets.end()) {
+        json::write(js, it->second);
+    } else {
+        js += Str("null");
+    }
+    js += ')';
+    eval(js, nullptr);
+    addInjectScript();  // For the pages that come next
+}
+#endif
 
-    // Sets the app as the active app
-    [NSApp activateIgnoringOtherApps:YES];
+// Calls to bound functions are sent through the same channel as
+// window.external.invoke, formatted as "\x1e<id>:<name>:<JSON args>"
+constexpr auto rpcRuntime = Str(
+    "window.__webview_rpc={id:0,calls:{},"
+    "call(name,args){return new Promise((resolve,reject)=>{"
+    "const id=++this.id;this.calls[id]={resolve,reject};"
+    "window.external.invoke('\x1e'+id+':'+name+':'+JSON.stringify(args));"
+    "});},"
+    "settle(id,ok,value){const c=this.calls[id];delete this.calls[id];"
+    "if(c)(ok?c.resolve:c.reject)(value);}};");
+
+void WebView::onMessage(StringView msg) {
+    if (!msg.empty() && msg[0] == '\x1d') {
+        onStreamMessage(msg);
+        return;
+    }
 
-    // Add webview to window
-    [window setContentView:webview];
+    if (msg.empty() || msg[0] != '\x1e') {
+        if (view_callback) {
+            view_callback(*this, msg);
+        } else if (js_callback) {
+            // The String& callback may modify the message, so it gets a copy
+            String copy(msg);
+            js_callback(*this, copy);
+        }
+        return;
+    }
 
-    // Display window
-    [window makeKeyAndOrderFront:nil];
+    StringView call = msg;
+    auto idEnd = call.find(':', 1);
+    auto nameEnd = idEnd == StringView::npos ? idEnd : call.find(':', idEnd + 1);
+    if (nameEnd == StringView::npos) {
+        return;
+    }
 
-    // Done initialization, set properties
-    init_done = true;
+    // The id is echoed back into a script, so make sure it's only digits
+    StringView id = call.substr(1, idEnd - 1);
+    if (id.empty() || std::any_of(id.begin(), id.end(), [](auto c) {
+            return c < '0' || c > '9';
+        })) {
+        return;
+    }
 
-    setTitle(title);
-    if (fullscreen) {
-        setFullscreen(true);
+    auto it = bindings.find(call.substr(idEnd + 1, nameEnd - idEnd - 1));
+    if (it == bindings.end()) {
+        settleCall(id, false, json::quote(Str("Function is not bound")));
+        return;
     }
-    setBgColor(bgR, bgG, bgB, bgA);
-    navigate(url);
+    it->second->fn(*this, id, call.substr(nameEnd + 1));
+}
 
-    return 0;
+void WebView::settleCall(StringView id, bool ok, const String& json) {
+    String js = Str("window.__webview_rpc.settle(");
+    js += id;
+    js += ok ? Str(",true,") : Str(",false,");
+    js += json;
+    js += Str(")");
+    eval(js, nullptr);
 }
 
-void WebView::setTitle(std::string t) {
-    if (!init_done) {
-        title = t;
-    } else {
-        [window setTitle:[NSString stringWithUTF8String:t.c_str()]];
+void WebView::addBinding(const String& name, rpccb fn) {
+    // The runtime is shared by every binding, so it's never removed
+    if (!rpcInjected) {
+        addUserScript(rpcRuntime);
+        rpcInjected = true;
     }
+
+    unbind(name);
+    String stub = Str("window[") + json::quote(name) +
+                  Str("]=(...args)=>window.__webview_rpc.call(") +
+                  json::quote(name) + Str(",args);");
+    auto binding = std::make_unique<Binding>(
+        Binding{name, std::move(fn), addUserScript(stub)});
+    StringView key = binding->name;
+    bindings.emplace(key, std::move(binding));
 }
 
-void WebView::setFullscreen(bool fs) {
-    if (!init_done) {
-        fullscreen = fs;
-    } else {
-        // TODO: replace toggle with set
-        [window toggleFullScreen:nil];
+void WebView::unbind(const String& name) {
+    auto it = bindings.find(name);
+    if (it == bindings.end()) {
+        return;
+    }
+
+    removeUserScript(it->second->stub);
+    if (init_done) {
+        eval(Str("delete window[") + json::quote(name) + Str("]"), nullptr);
     }
+    bindings.erase(it);
 }
 
-void WebView::setFullscreenFromJS(bool allow) { fullscreenFromJS = allow; }
+JSFunction WebView::registerFunction(const String& source) {
+    JSFunction fn(++lastFunctionId);
 
-void WebView::setBgColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
-    if (!init_done) {
-        bgR = r;
-        bgG = g;
-        bgB = b;
-        bgA = a;
-    } else {
-        [window setBackgroundColor:[NSColor colorWithCalibratedRed:r / 255.0
-                                                             green:g / 255.0
-                                                              blue:b / 255.0
-                                                             alpha:a / 255.0]];
-    }
+    String script = Str("(window.__webview_fn=window.__webview_fn||{})[");
+    json::write(script, fn.id);
+    script += Str("]=(");
+    script += source;
+    script += Str(");");
+
+    functions.emplace(fn.id, addUserScript(script));
+    return fn;
 }
 
-bool WebView::run() {
-    NSEvent* event = [NSApp nextEventMatchingMask:NSEventMaskAny
-                                        untilDate:[NSDate distantFuture]
-                                           inMode:NSDefaultRunLoopMode
-                                          dequeue:true];
-    if (event) {
-        [NSApp sendEvent:event];
+void WebView::unregisterFunction(JSFunction& fn) {
+    auto it = functions.find(fn.id);
+    if (it == functions.end()) {
+        return;
     }
 
-    return should_exit;
+    removeUserScript(it->second);
+    if (init_done) {
+        String js = Str("delete window.__webview_fn[");
+        json::write(js, fn.id);
+        js += ']';
+        eval(js, nullptr);
+    }
+    functions.erase(it);
+    fn.id = 0;
 }
 
-void WebView::navigate(std::string u) {
-    if (!init_done) {
-        url = u;
-    } else if (u.rfind("data:", 0) == 0) {
-        [webview loadHTMLString:[NSString stringWithUTF8String:u.c_str()]
-                        baseURL:nil];
-    } else {
-        [webview
-            loadRequest:[NSURLRequest
-                            requestWithURL:
-                                [NSURL URLWithString:[NSString
-                                                         stringWithUTF8String:
-                                                             u.c_str()]]]];
+void WebView::callFunction(const JSFunction& fn, const String& args,
+                           evalcb callback) {
+#if defined(WEBVIEW_GTK)
+#if WEBKIT_CHECK_VERSION(2, 40, 0)
+    // Batched calls must stay in order with the rest of the batch
+    if (ready && !batchEvals) {
+        stats.scripts++;
+        stats.batches++;
+        runFunction(fn.id, args, std::move(callback));
+        return;
     }
+#endif
+#endif
+
+    // Only the short call expression is parsed, not the function
+    String js = Str("window.__webview_fn[");
+    json::write(js, fn.id);
+    js += Str("](");
+    js.append(args, 1, args.size() - 2);  // Without the []
+    js += ')';
+    eval(js, std::move(callback));
 }
 
-void WebView::eval(const std::string& js) {
-    [webview evaluateJavaScript:[NSString stringWithUTF8String:js.c_str()]
-              completionHandler:nil];
+void WebView::setWorkers(size_t threads, size_t maxQueued) {
+    // Replacing a pool waits for its tasks to finish
+    workers = std::make_unique<WorkerPool>(threads, maxQueued);
 }
 
-void WebView::exit() {
-    // Distinguish window closing with app exiting
-    should_exit = true;
-    [NSApp terminate:nil];
+WorkerPool& WebView::workerPool() {
+    if (!workers) {
+        workers = std::make_unique<WorkerPool>();
+    }
+    return *workers;
 }
 
-#elif defined(WEBVIEW_GTK)  // WEBVIEW_MAC
-int WebView::init() {
-    if (gtk_init_check(0, NULL) == FALSE) {
-        return -1;
+std::shared_ptr<Stream> WebView::openStream(const String& name,
+                                            StreamOptions options) {
+    options.chunkSize = std::max<size_t>(options.chunkSize, 1);
+    options.highWaterMark = std::max(options.highWaterMark, options.chunkSize);
+
+    uint64_t id = ++lastStreamId;
+    auto stream = std::make_shared<Stream>(*this, id, options);
+    streams.emplace(id, stream);
+
+    String js = Str("window.__webview_stream.create(");
+    json::write(js, id);
+    js += ',';
+    json::quoteTo(js, name);
+    js += ',';
+    json::write(js, options.highWaterMark);
+    js += ')';
+    eval(js, nullptr);
+    return stream;
+}
+
+void WebView::onStreamMessage(StringView msg) {
+    // "\x1d<id>:<bytes>" or "\x1d<id>:c"
+    auto sep = msg.find(':');
+    if (sep == StringView::npos) {
+        return;
     }
 
-    // Initialize GTK window
-    window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    uint64_t id = 0;
+    json::Reader idReader(msg.substr(1, sep - 1));
+    auto it = idReader.read(id) && idReader.done() ? streams.find(id)
+                                                   : streams.end();
+    if (it == streams.end()) {
+        return;
+    }
 
-    if (resizable) {
-        gtk_window_set_default_size(GTK_WINDOW(window), width, height);
-    } else {
-        gtk_widget_set_size_request(window, width, height);
+    // The stream may be removed from the map while handling the message
+    std::shared_ptr<Stream> stream = it->second;
+    StringView arg = msg.substr(sep + 1);
+    size_t size = 0;
+    json::Reader sizeReader(arg);
+    if (arg == Str("c")) {
+        stream->cancel();
+    } else if (sizeReader.read(size) && sizeReader.done()) {
+        stream->ack(size);
     }
+}
 
-    gtk_window_set_resizable(GTK_WINDOW(window), resizable);
-    gtk_window_set_position(GTK_WINDOW(window), GTK_WIN_POS_CENTER);
+bool Stream::write(std::string_view data) {
+    if (closing || isCancelled) {
+        return false;
+    }
 
-    // Add scrolling container
-    GtkWidget* scroller = gtk_scrolled_window_new(nullptr, nullptr);
-    gtk_container_add(GTK_CONTAINER(window), scroller);
+    // Top up the last chunk first, so small writes don't become tiny chunks
+    while (!data.empty()) {
+        if (pending.empty() || pending.back().size() >= options.chunkSize) {
+            pending.emplace_back();
+        }
+        std::string& chunk = pending.back();
+        size_t n = std::min(data.size(), options.chunkSize - chunk.size());
+        chunk.append(data.substr(0, n));
+        queued += n;
+        data.remove_prefix(n);
+    }
+    send();
 
-    // Content manager
-    WebKitUserContentManager* cm = webkit_user_content_manager_new();
-    webkit_user_content_manager_register_script_message_handler(cm, "external");
-    g_signal_connect(cm, "script-message-received::external",
-                     G_CALLBACK(external_message_received_cb), this);
+    full = buffered() >= options.highWaterMark;
+    return !full;
+}
 
-    // WebView
-    webview = webkit_web_view_new_with_user_content_manager(cm);
-    g_signal_connect(G_OBJECT(webview), "load-changed",
-                     G_CALLBACK(webview_load_changed_cb), this);
-    gtk_container_add(GTK_CONTAINER(scroller), webview);
+void Stream::close() {
+    if (closing || isCancelled) {
+        return;
+    }
+    closing = true;
+    send();
+}
 
-    g_signal_connect(window, "destroy", G_CALLBACK(destroyWindowCb), this);
-    // g_signal_connect(webview, "close", G_CALLBACK(closeWebViewCb), window);
+void Stream::onDrain(std::function<void()> callback) {
+    drainCallback = std::move(callback);
+}
 
-    // Dev Tools if debug
-    if (debug) {
-        WebKitSettings* settings =
-            webkit_web_view_get_settings(WEBKIT_WEB_VIEW(webview));
-        webkit_settings_set_enable_write_console_messages_to_stdout(settings,
-                                                                    true);
-        webkit_settings_set_enable_developer_extras(settings, true);
-    } else {
-        g_signal_connect(G_OBJECT(webview), "context-menu",
-                         G_CALLBACK(webview_context_menu_cb), nullptr);
+void Stream::send() {
+    while (!pending.empty() && inFlight < options.highWaterMark) {
+        String js = Str("window.__webview_stream.chunk(");
+        json::write(js, id);
+        js += Str(",'");
+        detail::base64Encode(pending.front(), js);
+        js += Str("')");
+        w.eval(js, nullptr);
+
+        inFlight += pending.front().size();
+        queued -= pending.front().size();
+        pending.pop_front();
     }
 
-    webkit_user_content_manager_add_script(
-        cm, webkit_user_script_new(
-                inject.c_str(), WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
-                WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START, NULL, NULL));
+    if (closing && pending.empty()) {
+        // JS closes the stream after the chunks already sent
+        String js = Str("window.__webview_stream.close(");
+        json::write(js, id);
+        js += ')';
+        w.eval(js, nullptr);
+        w.streams.erase(id);
+    }
+}
 
-    // Monitor for fullscreen changes
-    g_signal_connect(G_OBJECT(webview), "enter-fullscreen",
-                     G_CALLBACK(webview_enter_fullscreen_cb), this);
-    g_signal_connect(G_OBJECT(webview), "leave-fullscreen",
-                     G_CALLBACK(webview_leave_fullscreen_cb), this);
+void Stream::ack(size_t size) {
+    inFlight -= std::min(size, inFlight);
+    send();
 
-    // Done initialization, set properties
-    init_done = true;
+    if (full && buffered() < options.highWaterMark) {
+        full = false;
+        if (drainCallback) {
+            drainCallback();
+        }
+    }
+}
 
-    setTitle(title);
-    if (fullscreen) {
-        setFullscreen(true);
+void Stream::cancel() {
+    isCancelled = true;
+    pending.clear();
+    queued = 0;
+    inFlight = 0;
+    w.streams.erase(id);
+}
+
+bool WebView::poll() { return runFor(std::chrono::milliseconds(0)); }
+
+void WebView::dispatch(dispatchcb fn) {
+    dispatched.push(std::move(fn));
+    if (!wakePending.exchange(true)) {
+        wakeUp();
     }
-    setBgColor(bgR, bgG, bgB, bgA);
-    navigate(url);
+}
 
-    // Finish
-    gtk_widget_grab_focus(GTK_WIDGET(webview));
-    gtk_widget_show_all(window);
+void WebView::runDispatched() {
+    // Reading the flag with an exchange also makes the pushes of everyone
+    // who set it visible here
+    wakePending.exchange(false);
 
-    return 0;
+    dispatchcb fn;
+    size_t count = 0;
+    while (count < maxDispatchPerWakeup && dispatched.pop(fn)) {
+        fn(*this);
+        count++;
+    }
+
+    // Batched evals are sent from here too, so they don't depend on this
+    // WebView's run() when another one drives the loop
+    flushEvals();
+
+    // Let input and rendering run before the rest
+    if (count == maxDispatchPerWakeup && !wakePending.exchange(true)) {
+        wakeUp();
+    }
 }
 
-void WebView::setTitle(std::string t) {
-    if (!init_done) {
-        title = t;
+void WebView::eval(const wv::String& js, evalcb callback) {
+    stats.scripts++;
+    if (batchEvals) {
+        evalQueue.emplace_back(js, std::move(callback));
+        if (evalQueue.size() == 1 && !wakePending.exchange(true)) {
+            wakeUp();
+        }
     } else {
-        gtk_window_set_title(GTK_WINDOW(window), t.c_str());
+        stats.batches++;
+        runScript(js, std::move(callback));
     }
 }
 
-void WebView::setFullscreen(bool fs) {
-    if (!init_done) {
-        fullscreen = fs;
-    } else if (fs) {
-        gtk_window_fullscreen(GTK_WINDOW(window));
-    } else {
-        gtk_window_unfullscreen(GTK_WINDOW(window));
+void WebView::setEvalBatching(bool batch) {
+    batchEvals = batch;
+    if (!batch) {
+        flushEvals();
     }
 }
 
-void WebView::setFullscreenFromJS(bool allow) { fullscreenFromJS = allow; }
+EvalStats WebView::evalStats() const { return stats; }
 
-void WebView::setBgColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
-    if (!init_done) {
-        bgR = r;
-        bgG = g;
-        bgB = b;
-        bgA = a;
-    } else {
-        GdkRGBA color = {r / 255.0, g / 255.0, b / 255.0, a / 255.0};
-        webkit_web_view_set_background_color(WEBKIT_WEB_VIEW(webview), &color);
+void WebView::flushEvals() {
+    if (evalQueue.empty()) {
+        return;
+    }
+
+    auto queue = std::move(evalQueue);
+    evalQueue.clear();
+
+    // Each script runs in its own try/catch through a global eval, so one
+    // failing script (even with a syntax error) doesn't affect the others.
+    // The batch evaluates to [[ok, JSON.stringify(result) or error], ...].
+    // Unlike a top-level script, a global eval keeps let and const to
+    // itself; see the setEvalBatching docs.
+    wv::String batch = Str("[");
+    std::vector<evalcb> callbacks;
+    callbacks.reserve(queue.size());
+    for (auto& [js, callback] : queue) {
+        batch += Str("(()=>{try{return[1,JSON.stringify((0,eval)(");
+        batch += json::quote(js);
+        batch += Str("))]}catch(e){return[0,String(e)]}})(),");
+        callbacks.push_back(std::move(callback));
     }
+    batch += Str("]");
+
+    stats.batches++;
+    runScript(batch, [callbacks = std::move(callbacks)](
+                         WebView& w, bool ok, wv::String& result) {
+        if (!ok) {
+            // The batch itself failed, so none of the scripts ran
+            for (auto& callback : callbacks) {
+                if (callback) callback(w, false, result);
+            }
+            return;
+        }
+
+        size_t pos = 1;  // Skip the opening [
+        wv::String value;
+        for (auto& callback : callbacks) {
+            // Each item is [1,"json"], [1,null] or [0,"error"]
+            pos = result.find('[', pos);
+            if (pos == wv::String::npos || pos + 3 >= result.size()) {
+                return;
+            }
+            bool itemOk = result[pos + 1] == '1';
+            pos += 3;
+            if (result[pos] == '"') {
+                json::unquote(result, pos, value);
+            } else {
+                value = Str("null");
+            }
+
+            if (callback) callback(w, itemOk, value);
+        }
+    });
 }
 
-bool WebView::run() {
-    gtk_main_iteration_do(true);
-    return should_exit;
+void WebView::preEval(const wv::String& js) {
+    addUserScript(Str("(()=>{") + js + Str("})()"));
 }
 
-void WebView::navigate(std::string u) {
-    if (!init_done) {
-        url = u;
-    } else {
-        webkit_web_view_load_uri(WEBKIT_WEB_VIEW(webview), u.c_str());
+UserScript WebView::addUserScript(const wv::String& js, InjectTime time,
+                                  InjectFrames frames) {
+    UserScript script(++lastUserScriptId);
+    userScripts.emplace(script.id, UserScriptSource{js, time, frames});
+    updateUserScript(script.id);
+
+    // The current page is past injection, so run it there now
+    if (init_done) {
+        eval(js, nullptr);
     }
+    return script;
 }
 
-void WebView::eval(const std::string& js) {
-    while (!ready) {
-        g_main_context_iteration(NULL, TRUE);
-    }
-    js_busy = true;
-    webkit_web_view_run_javascript(WEBKIT_WEB_VIEW(webview), js.c_str(), NULL,
-                                   webview_eval_finished, this);
-    while (js_busy) {
-        g_main_context_iteration(NULL, TRUE);
+void WebView::removeUserScript(UserScript& script) {
+    if (userScripts.erase(script.id) != 0) {
+        updateUserScript(script.id);
     }
+    script.id = 0;
 }
 
-void WebView::exit() { should_exit = true; }
+WorkerPool::WorkerPool(size_t threads, size_t maxQueued_)
+    : maxQueued(maxQueued_) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
 
-void WebView::external_message_received_cb(WebKitUserContentManager*,
-                                           WebKitJavascriptResult* r,
-                                           gpointer arg) {
-    WebView* w = static_cast<WebView*>(arg);
-    if (w->js_callback) {
-        JSCValue* value = webkit_javascript_result_get_js_value(r);
-        std::string str = std::string(jsc_value_to_string(value));
-        w->js_callback(*w, str);
+    for (size_t i = 0; i < threads; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    // Start threads only once every queue exists, since they steal
+    for (size_t i = 0; i < threads; i++) {
+        workers[i]->thread = std::thread(&WorkerPool::work, this, i);
     }
 }
 
-void WebView::webview_eval_finished(GObject*, GAsyncResult*, gpointer arg) {
-    static_cast<WebView*>(arg)->js_busy = false;
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker->thread.join();
+    }
 }
 
-void WebView::webview_load_changed_cb(WebKitWebView*, WebKitLoadEvent event,
-                                      gpointer arg) {
-    if (event == WEBKIT_LOAD_FINISHED) {
-        static_cast<WebView*>(arg)->ready = true;
+bool WorkerPool::submit(Task task) {
+    if (!reserve()) {
+        return false;
     }
-}
 
-void WebView::destroyWindowCb(GtkWidget*, gpointer arg) {
-    static_cast<WebView*>(arg)->exit();
+    push([this, task = std::move(task)]() {
+        queued--;
+        task();
+    });
+    return true;
 }
 
-// gboolean WebView::closeWebViewCb(WebKitWebView *webView, GtkWidget *window) {
-//   gtk_widget_destroy(window);
-//   return TRUE;
-// }
+bool WorkerPool::submit(const String& name, Task task) {
+    if (!reserve()) {
+        return false;
+    }
 
-gboolean WebView::webview_context_menu_cb(WebKitWebView*, GtkWidget*,
-                                          WebKitHitTestResult*, gboolean,
-                                          gpointer) {
-    // Always hide context menu if not debug
-    return TRUE;
+    std::shared_ptr<Channel> channel;
+    {
+        std::lock_guard<std::mutex> lock(channelsMutex);
+        auto& slot = channels[name];
+        if (!slot) {
+            slot = std::make_shared<Channel>();
+        }
+        channel = slot;
+    }
+
+    bool start;
+    {
+        std::lock_guard<std::mutex> lock(channel->mutex);
+        channel->tasks.push_back(std::move(task));
+        start = !std::exchange(channel->running, true);
+    }
+    if (start) {
+        push([this, channel]() { runChannel(channel); });
+    }
+    return true;
 }
 
-gboolean WebView::webview_enter_fullscreen_cb(WebKitWebView*, gpointer arg) {
-    return !static_cast<WebView*>(arg)->fullscreenFromJS;
+bool WorkerPool::reserve() {
+    size_t n = queued.load();
+    do {
+        if (n >= maxQueued) {
+            return false;
+        }
+    } while (!queued.compare_exchange_weak(n, n + 1));
+    return true;
 }
 
-gboolean WebView::webview_leave_fullscreen_cb(WebKitWebView*, gpointer arg) {
-    return !static_cast<WebView*>(arg)->fullscreenFromJS;
+void WorkerPool::push(Task task) {
+    Worker& worker = *workers[next++ % workers.size()];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+    ready++;
+
+    // Lock so the notify can't slip in between a worker's check and wait
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    wake.notify_one();
 }
-#endif                      // WEBVIEW_GTK
 
-void WebView::css(const wv::String& css) {
-    eval(Str(R"js(
-    (
-      function (css) {
-        if (document.styleSheets.length === 0) {
-          var s = document.createElement('style');
-          s.type = 'text/css';
-          document.head.appendChild(s);
+bool WorkerPool::pop(size_t index, Task& task) {
+    // Take the oldest task from our own queue, or the newest from another
+    for (size_t i = 0; i < workers.size(); i++) {
+        Worker& worker = *workers[(index + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.tasks.empty()) {
+            continue;
         }
-        document.styleSheets[0].insertRule(css);
-      }
-    )(')js") +
-         css + Str("')"));
+
+        if (i == 0) {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+        } else {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+        }
+        ready--;
+        return true;
+    }
+    return false;
+}
+
+void WorkerPool::runChannel(const std::shared_ptr<Channel>& channel) {
+    Task task;
+    {
+        std::lock_guard<std::mutex> lock(channel->mutex);
+        task = std::move(channel->tasks.front());
+        channel->tasks.pop_front();
+    }
+    queued--;
+    task();
+
+    // Run one task at a time so a busy channel can't hog a worker
+    bool more;
+    {
+        std::lock_guard<std::mutex> lock(channel->mutex);
+        more = !channel->tasks.empty();
+        channel->running = more;
+    }
+    if (more) {
+        push([this, channel]() { runChannel(channel); });
+    }
 }
 
-void WebView::setCallback(jscb callback) { js_callback = callback; }
+void WorkerPool::work(size_t index) {
+    for (;;) {
+        Task task;
+        if (pop(index, task)) {
+            task();
+            continue;
+        }
 
-void WebView::preEval(const wv::String& js) {
-    inject += Str("(()=>{") + js + Str("})()");  // TODO: is the IIFE necessary?
+        // Queued tasks are finished before stopping
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this]() { return stopping || ready > 0; });
+        if (stopping && ready == 0) {
+            return;
+        }
+    }
 }
 
 }  // namespace wv